@@ -0,0 +1,1039 @@
+/*
+ * JACK-free DSP benchmark harness.
+ *
+ * Each tool is compiled with -Dmain=tool_main and linked against this
+ * file instead of libjack.  The functions below stand in for the JACK
+ * client API: ports get plain buffers, jack_get_sample_rate() returns
+ * the rate under test, and jack_activate() never returns -- it drives
+ * the tool's process callback directly, sweeping period sizes, and
+ * prints per-cycle timings before exiting.
+ *
+ * Usage: bench_<tool> [ -r rates ] [ -p periods ] [ -V voices ] [ -s seconds ] [ -u units ] [ -d | -m | -l frames[,jitter] ] [ -- tool args ]
+ *
+ * Every rate/voice-count combination runs in a forked child so each
+ * starts from the tool's own initial state.  For a voice count, that
+ * many note-ons are fed to every MIDI input port on the first cycle.
+ * With -u, the load is also given per unit of work the tool was asked
+ * for, e.g. per second of impulse response.
+ *
+ * -d is the denormal regression test: for each period size the tool
+ * gets a burst of noise (and note-ons) followed by silence (and
+ * note-offs), and the median cycle of the worst DECAY_WINDOW (at least
+ * 8 cycles) of the silent part must cost no more than DECAY_LIMIT times
+ * the burst's per frame.  Filters whose
+ * state decays into subnormals fail this by a wide margin.
+ *
+ * -m is the MIDI clock jitter test: every clock byte (0xf8) the tool
+ * writes to a MIDI output is timed in absolute frames, a straight
+ * line is fitted through them, and no pulse may be more than
+ * CLOCK_LIMIT frames off it.  Rounding to whole frames costs half a
+ * frame; a grid kept in whole frames drifts off by many.
+ *
+ * -l is loopback, a stand-in for the dummy backend with a cable from
+ * the outputs back to the inputs: jack_activate() returns, a driver
+ * thread runs the process callback in real time, and every output
+ * comes back on an input of its type the given number of frames later,
+ * so a tool can measure its own round trip.  MIDI events can also be
+ * held up to jitter frames more, at random and in order, the way a
+ * bridge to ALSA would.  Each period size runs in its own child, the
+ * tool's exit status is the result, and one still running after -s
+ * seconds fails.  A delay under one period is one period, as for a
+ * client wired to itself.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <math.h>
+#include <sys/wait.h>
+#include <jack/jack.h>
+#include <jack/midiport.h>
+#include <jack/ringbuffer.h>
+#include <jack/thread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define MAXPORTS (64)
+#define MAXFRAMES (4096)
+#define MAXEVENTS (1024)
+#define MAXLIST (16)
+
+#define BURST_SECONDS (0.25)
+#define DECAY_WINDOW (0.05)  /* seconds */
+#define DECAY_LIMIT (2.0)
+#define DECAY_CYCLES (256)   /* most cycles per window */
+#define CLOCK_LIMIT (1.0)    /* frames */
+#define LOOP_EVENTS (4096)   /* MIDI events in flight per loopback input */
+
+int tool_main (int argc, char *argv[]);
+
+struct _jack_client {
+  char name[64];
+  };
+
+typedef struct {
+  uint64_t frame;
+  uint32_t size;
+  jack_midi_data_t data[4];
+  } loop_event;
+
+typedef struct {
+  uint32_t count;
+  jack_midi_event_t ev[MAXEVENTS];
+  jack_midi_data_t data[MAXEVENTS][4];
+  } midibuf;
+
+struct _jack_port {
+  char name[128];
+  int midi;
+  unsigned long flags;
+  jack_default_audio_sample_t audio[MAXFRAMES];
+  midibuf mbuf;
+  struct _jack_port *loop;           /* loopback: the input this output feeds */
+  jack_default_audio_sample_t *ring; /* loopback: an input's delay line */
+  loop_event *pending;               /* loopback: MIDI on its way, in order */
+  int npending;
+  };
+
+static struct _jack_client the_client;
+static jack_port_t ports[MAXPORTS];
+static int nports;
+
+static JackProcessCallback process_cb;
+static void *process_arg;
+static JackThreadInitCallback thread_init_cb;
+static void *thread_init_arg;
+static JackBufferSizeCallback buffer_size_cb;
+static void *buffer_size_arg;
+static jack_nframes_t buffer_size;
+static JackTimebaseCallback timebase_cb;
+static void *timebase_arg;
+
+static jack_nframes_t bench_rate = 48000;
+static jack_nframes_t bench_period = 256;
+static int bench_voices = 0;
+static double bench_seconds = 1.0;
+static int bench_decay = 0;
+static int bench_clock = 0;
+static double bench_units = 0;
+static int bench_loopback = 0;
+static jack_nframes_t loop_delay = 0;
+static jack_nframes_t loop_jitter = 0;
+static int periods[MAXLIST] = { 16, 32, 64, 128, 256, 512, 1024, 2048, 4096 };
+static int nperiods = 9;
+
+static uint64_t frame_clock = 0;
+
+static pthread_t loop_thread;
+static volatile int loop_running = 0;
+static size_t loop_mask;
+
+/* ---- harness ---- */
+
+static uint64_t now_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t now_tsc (void)
+{
+#ifdef HAVE_TSC
+  return __rdtsc ();
+#else
+  return 0;
+#endif
+}
+
+static int cmp_u64 (const void *a, const void *b)
+{
+  const uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+  return x < y ? -1 : (x > y);
+}
+
+static int parse_list (const char *s, int *list)
+{
+  int n = 0;
+
+  while (*s && n < MAXLIST) {
+    list[n++] = atoi (s);
+    while (*s && *s != ',') {
+      s++;
+      }
+    if (*s == ',') {
+      s++;
+      }
+    }
+  return n;
+}
+
+static void fill_inputs (void)
+{
+  uint32_t seed = 1;
+  int p, i;
+
+  for (p=0; p<nports; p++) {
+    if (ports[p].midi || !(ports[p].flags & JackPortIsInput)) {
+      continue;
+      }
+    for (i=0; i<MAXFRAMES; i++) {
+      seed = seed * 1664525 + 1013904223;
+      ports[p].audio[i] = ((int32_t) seed >> 8) * (0.5f / (1 << 23));
+      }
+    }
+}
+
+static void silence_inputs (void)
+{
+  int p;
+
+  for (p=0; p<nports; p++) {
+    if (!ports[p].midi && (ports[p].flags & JackPortIsInput)) {
+      memset (ports[p].audio, 0, sizeof (ports[p].audio));
+      }
+    }
+}
+
+/* queue note-ons (status 0x90) or note-offs (0x80) for bench_voices
+   voices on every MIDI input */
+static void queue_voices (int status)
+{
+  int p, v;
+
+  for (p=0; p<nports; p++) {
+    midibuf *m = &ports[p].mbuf;
+
+    if (!ports[p].midi || !(ports[p].flags & JackPortIsInput)) {
+      continue;
+      }
+    for (v=0; v<bench_voices && v<MAXEVENTS; v++) {
+      m->data[v][0] = status | (v % 16);
+      m->data[v][1] = 24 + (v / 16) % 96;
+      m->data[v][2] = 100;
+      m->ev[v].time = 0;
+      m->ev[v].size = 3;
+      m->ev[v].buffer = m->data[v];
+      }
+    m->count = v;
+    }
+}
+
+static void clear_midi_inputs (void)
+{
+  int p;
+
+  for (p=0; p<nports; p++) {
+    if (ports[p].midi && (ports[p].flags & JackPortIsInput)) {
+      ports[p].mbuf.count = 0;
+      }
+    }
+}
+
+static void run_cycle (jack_nframes_t nframes)
+{
+  int p;
+
+  /* as the server does, announce a new period size before its first cycle */
+  if (nframes != buffer_size) {
+    buffer_size = nframes;
+    if (buffer_size_cb) {
+      buffer_size_cb (nframes, buffer_size_arg);
+      }
+    }
+  for (p=0; p<nports; p++) {
+    if (ports[p].midi && (ports[p].flags & JackPortIsOutput)) {
+      ports[p].mbuf.count = 0;
+      }
+    }
+  process_cb (nframes, process_arg);
+  frame_clock += nframes;
+}
+
+static void bench_period_size (jack_nframes_t period)
+{
+  const int warmup = 16;
+  int cycles = bench_seconds * bench_rate / period;
+  uint64_t *ns, t0, c0, tsc = 0, total = 0;
+  int i;
+
+  if (cycles < 64) {
+    cycles = 64;
+    }
+  ns = malloc (cycles * sizeof (uint64_t));
+
+  bench_period = period;
+  for (i=0; i<warmup; i++) {
+    run_cycle (period);
+    }
+  for (i=0; i<cycles; i++) {
+    c0 = now_tsc ();
+    t0 = now_ns ();
+    run_cycle (period);
+    ns[i] = now_ns () - t0;
+    tsc += now_tsc () - c0;
+    total += ns[i];
+    }
+
+  qsort (ns, cycles, sizeof (uint64_t), cmp_u64);
+
+  printf ("%6u %6u %5d %10.2f", bench_rate, period, bench_voices, (double) total / cycles / period);
+#ifdef HAVE_TSC
+  printf (" %10.2f", (double) tsc / cycles / period);
+#else
+  printf (" %10s", "-");
+#endif
+  printf (" %9.2f %9.2f %9.2f %7.2f%%",
+          ns[cycles / 2] / 1e3, ns[cycles * 99 / 100] / 1e3, ns[cycles - 1] / 1e3,
+          100.0 * total / cycles / (1e9 * period / bench_rate));
+  if (bench_units > 0) {
+    printf (" %9.3f%%", 100.0 * total / cycles / (1e9 * period / bench_rate) / bench_units);
+    }
+  printf ("\n");
+  fflush (stdout);
+  free (ns);
+}
+
+/* median ns per frame over n cycles, so one preempted cycle does not
+   count as a spike */
+static double time_cycles (jack_nframes_t period, int n)
+{
+  uint64_t ns[DECAY_CYCLES], t0;
+  int i;
+
+  for (i=0; i<n; i++) {
+    t0 = now_ns ();
+    run_cycle (period);
+    ns[i] = now_ns () - t0;
+    clear_midi_inputs ();
+    }
+  qsort (ns, n, sizeof (uint64_t), cmp_u64);
+  return (double) ns[n / 2] / period;
+}
+
+/* burst then silence; returns nonzero if the silence costs too much */
+static int bench_decay_period (jack_nframes_t period)
+{
+  const int window = DECAY_WINDOW * bench_rate / period > DECAY_CYCLES ? DECAY_CYCLES
+                   : DECAY_WINDOW * bench_rate / period > 8 ? DECAY_WINDOW * bench_rate / period : 8;
+  const int bursts = BURST_SECONDS * bench_rate / period / window;
+  const int silences = bench_seconds * bench_rate / period / window;
+  double burst = 0, worst = 0, t;
+  int i;
+
+  bench_period = period;
+  fill_inputs ();
+  queue_voices (0x90);
+  for (i=0; i<bursts || i<1; i++) {
+    burst += time_cycles (period, window);
+    }
+  burst /= i;
+
+  silence_inputs ();
+  queue_voices (0x80);
+  for (i=0; i<silences; i++) {
+    t = time_cycles (period, window);
+    worst = t > worst ? t : worst;
+    }
+
+  printf ("%6u %6u %5d %10.2f %10.2f %8.2f  %s\n", bench_rate, period, bench_voices,
+          burst, worst, worst / burst, worst > DECAY_LIMIT * burst ? "FAIL" : "ok");
+  fflush (stdout);
+  return worst > DECAY_LIMIT * burst;
+}
+
+/* clock pulses against the line fitted through them; returns nonzero
+   if one strays too far */
+static int bench_clock_period (jack_nframes_t period)
+{
+  int cycles = bench_seconds * bench_rate / period;
+  size_t n = 0, cap = 1024, k;
+  double *t = malloc (cap * sizeof (double));
+  double mk, mt, sxy = 0, sxx = 0, slope, dev, worst = 0, ss = 0;
+  uint64_t base;
+  uint32_t e;
+  int i, p;
+
+  if (cycles < 64) {
+    cycles = 64;
+    }
+  bench_period = period;
+  for (i=0; i<cycles; i++) {
+    base = frame_clock;
+    run_cycle (period);
+    for (p=0; p<nports; p++) {
+      const midibuf *m = &ports[p].mbuf;
+      if (!ports[p].midi || !(ports[p].flags & JackPortIsOutput)) {
+        continue;
+        }
+      for (e=0; e<m->count; e++) {
+        if (m->ev[e].size == 1 && m->ev[e].buffer[0] == 0xf8) {
+          if (n == cap) {
+            t = realloc (t, (cap *= 2) * sizeof (double));
+            }
+          t[n++] = base + m->ev[e].time;
+          }
+        }
+      }
+    }
+
+  if (n < 3) {
+    printf ("%6u %6u  %zu clock pulses, need at least 3  FAIL\n", bench_rate, period, n);
+    free (t);
+    return 1;
+    }
+  mk = (n - 1) / 2.0;
+  for (k=0, mt=0; k<n; k++) {
+    mt += t[k] / n;
+    }
+  for (k=0; k<n; k++) {
+    sxy += (k - mk) * (t[k] - mt);
+    sxx += (k - mk) * (k - mk);
+    }
+  slope = sxy / sxx;
+  for (k=0; k<n; k++) {
+    dev = t[k] - (mt + (k - mk) * slope);
+    ss += dev * dev;
+    worst = fabs (dev) > worst ? fabs (dev) : worst;
+    }
+
+  printf ("%6u %6u %7zu %12.4f %9.3f %9.3f %9.2f  %s\n", bench_rate, period, n, slope,
+          sqrt (ss / n), worst, worst * 1e6 / bench_rate, worst > CLOCK_LIMIT ? "FAIL" : "ok");
+  fflush (stdout);
+  free (t);
+  return worst > CLOCK_LIMIT;
+}
+
+/* the k-th output of a type feeds the k-th input of that type, wrapping
+   round, and outputs meeting on one input are summed */
+static jack_port_t *loop_target (int p)
+{
+  int k = 0, n = 0, q;
+
+  for (q=0; q<nports; q++) {
+    if (ports[q].midi == ports[p].midi) {
+      k += q < p && (ports[q].flags & JackPortIsOutput);
+      n += (ports[q].flags & JackPortIsInput) != 0;
+      }
+    }
+  if (n == 0) {
+    return NULL;
+    }
+  k %= n;
+  for (q=0; q<nports; q++) {
+    if (ports[q].midi == ports[p].midi && (ports[q].flags & JackPortIsInput) && k-- == 0) {
+      return &ports[q];
+      }
+    }
+  return NULL;
+}
+
+static void loop_open (void)
+{
+  size_t size;
+  int p;
+
+  for (size = 1; size < loop_delay + 2 * MAXFRAMES; size <<= 1);
+  loop_mask = size - 1;
+  for (p=0; p<nports; p++) {
+    if (ports[p].flags & JackPortIsOutput) {
+      ports[p].loop = loop_target (p);
+    } else if (ports[p].midi) {
+      ports[p].pending = malloc (LOOP_EVENTS * sizeof (loop_event));
+    } else {
+      ports[p].ring = calloc (size, sizeof (jack_default_audio_sample_t));
+      }
+    }
+}
+
+/* queue a MIDI event on an input, keeping them in time order */
+static void loop_midi (jack_port_t *t, uint64_t frame, const jack_midi_event_t *ev)
+{
+  static uint32_t seed = 1;
+  int k;
+
+  if (t->npending == LOOP_EVENTS || ev->size > sizeof (t->pending[0].data)) {
+    return;
+    }
+  if (loop_jitter) {
+    seed = seed * 1664525 + 1013904223;
+    frame += (seed >> 8) % (loop_jitter + 1);
+    }
+  for (k=t->npending; k>0 && t->pending[k - 1].frame > frame; k--) {
+    t->pending[k] = t->pending[k - 1];
+    }
+  t->pending[k].frame = frame;
+  t->pending[k].size = ev->size;
+  memcpy (t->pending[k].data, ev->buffer, ev->size);
+  t->npending++;
+}
+
+static void loop_cycle (jack_nframes_t nframes)
+{
+  const uint64_t base = frame_clock;
+  const uint64_t delay = loop_delay > nframes ? loop_delay : nframes;
+  jack_nframes_t i;
+  int p;
+
+  for (p=0; p<nports; p++) {
+    jack_default_audio_sample_t *ring = ports[p].ring;
+    midibuf *m = &ports[p].mbuf;
+    int k;
+
+    if (ring) {
+      for (i=0; i<nframes; i++) {
+        ports[p].audio[i] = ring[(base + i) & loop_mask];
+        ring[(base + i) & loop_mask] = 0;
+        }
+      }
+    if (ports[p].pending) {
+      for (k=0; k<ports[p].npending && ports[p].pending[k].frame < base + nframes && k<MAXEVENTS; k++) {
+        memcpy (m->data[k], ports[p].pending[k].data, ports[p].pending[k].size);
+        m->ev[k].time = ports[p].pending[k].frame - base;
+        m->ev[k].size = ports[p].pending[k].size;
+        m->ev[k].buffer = m->data[k];
+        }
+      m->count = k;
+      ports[p].npending -= k;
+      memmove (ports[p].pending, ports[p].pending + k, ports[p].npending * sizeof (loop_event));
+      }
+    }
+  run_cycle (nframes);
+  for (p=0; p<nports; p++) {
+    jack_port_t *t = ports[p].loop;
+    uint32_t e;
+
+    if (t && t->midi) {
+      for (e=0; e<ports[p].mbuf.count; e++) {
+        loop_midi (t, base + delay + ports[p].mbuf.ev[e].time, &ports[p].mbuf.ev[e]);
+        }
+    } else if (t) {
+      for (i=0; i<nframes; i++) {
+        t->ring[(base + delay + i) & loop_mask] += ports[p].audio[i];
+        }
+      }
+    }
+}
+
+/* the dummy backend: one period per period of wall clock, until the
+   tool deactivates */
+static void *loop_driver (void *arg)
+{
+  const uint64_t t0 = now_ns ();
+  const uint64_t limit = bench_seconds * bench_rate;
+  struct timespec next;
+  uint64_t t;
+
+  if (thread_init_cb) {
+    thread_init_cb (thread_init_arg);
+    }
+  while (loop_running) {
+    loop_cycle (bench_period);
+    if (frame_clock >= limit) {
+      fprintf (stderr, "bench: tool still running after %gs\n", bench_seconds);
+      exit (EXIT_FAILURE);
+      }
+    t = t0 + frame_clock * 1000000000 / bench_rate;
+    next.tv_sec = t / 1000000000;
+    next.tv_nsec = t % 1000000000;
+    clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+  return NULL;
+}
+
+static int bench_run (void)
+{
+  int i, failed = 0;
+
+  if (thread_init_cb) {
+    thread_init_cb (thread_init_arg);
+    }
+  if (bench_decay) {
+    for (i=0; i<nperiods; i++) {
+      if (periods[i] > 0 && periods[i] <= MAXFRAMES) {
+        failed |= bench_decay_period (periods[i]);
+        }
+      }
+    return failed;
+    }
+  if (bench_clock) {
+    for (i=0; i<nperiods; i++) {
+      if (periods[i] > 0 && periods[i] <= MAXFRAMES) {
+        failed |= bench_clock_period (periods[i]);
+        }
+      }
+    return failed;
+    }
+
+  fill_inputs ();
+  queue_voices (0x90);
+  run_cycle (periods[0]);
+  clear_midi_inputs ();
+
+  for (i=0; i<nperiods; i++) {
+    if (periods[i] > 0 && periods[i] <= MAXFRAMES) {
+      bench_period_size (periods[i]);
+      }
+    }
+  return 0;
+}
+
+static void usage (const char *argv0)
+{
+  fprintf (stderr, "usage: %s [ -r rates ] [ -p periods ] [ -V voices ] [ -s seconds ] [ -u units ] [ -d | -m | -l frames[,jitter] ] [ -- tool args ]\n"
+"  lists are comma separated, e.g. -p 64,256 -r 48000,96000\n"
+"  -u  also print the load divided by units, e.g. seconds of IR\n"
+"  -d  denormal test: burst then silence, fail if silence costs over %.1fx\n"
+"  -m  MIDI clock test: fail if a pulse strays over %.1f frames from the fitted grid\n"
+"  -l  loopback in real time, outputs back to inputs this many frames later,\n"
+"      MIDI up to jitter frames more; the tool's exit status is the result,\n"
+"      -s is its time limit\n", argv0, DECAY_LIMIT, CLOCK_LIMIT);
+  exit (EXIT_FAILURE);
+}
+
+int main (int argc, char *argv[])
+{
+  int rates[MAXLIST] = { 44100, 48000, 96000 };
+  int nrates = 3;
+  int voices[MAXLIST] = { 0 };
+  int nvoices = 1;
+  int loop[MAXLIST] = { 0, 0 };
+  int opt, r, v, p, status, failed = 0;
+  pid_t pid;
+
+  while ((opt = getopt (argc, argv, "r:p:V:s:u:dml:h")) != -1) {
+    switch (opt) {
+      case 'r':
+        nrates = parse_list (optarg, rates);
+        break;
+      case 'p':
+        nperiods = parse_list (optarg, periods);
+        break;
+      case 'V':
+        nvoices = parse_list (optarg, voices);
+        break;
+      case 's':
+        bench_seconds = atof (optarg);
+        break;
+      case 'd':
+        bench_decay = 1;
+        break;
+      case 'm':
+        bench_clock = 1;
+        break;
+      case 'u':
+        bench_units = atof (optarg);
+        break;
+      case 'l':
+        parse_list (optarg, loop);
+        bench_loopback = 1;
+        loop_delay = loop[0];
+        loop_jitter = loop[1];
+        break;
+      default:
+        usage (argv[0]);
+      }
+    }
+
+  /* what is left goes to the tool, with its own name as argv[0] */
+  argv[optind - 1] = argv[0];
+  argc -= optind - 1;
+  argv += optind - 1;
+
+  printf ("# %s\n", argv[0]);
+  if (bench_decay) {
+    printf ("#  rate period voices  burst(ns)  worst(ns)    ratio  (ns/frame, worst %gs of silence)\n", DECAY_WINDOW);
+  } else if (bench_clock) {
+    printf ("#  rate period  pulses interval(fr)   rms(fr)   max(fr)   max(us)\n");
+  } else if (bench_loopback) {
+    printf ("#  rate period  loop(fr)  then what the tool reports\n");
+  } else {
+    printf ("#  rate period voices    ns/frame cyc/sample   p50(us)   p99(us)   max(us)    load%s\n",
+            bench_units > 0 ? "  load/unit" : "");
+    }
+  fflush (stdout);
+
+  /* without loopback a child sweeps the periods itself */
+  for (r=0; r<nrates; r++) {
+    for (v=0; v<nvoices; v++) {
+      for (p=0; p<(bench_loopback ? nperiods : 1); p++) {
+        if (bench_loopback && (periods[p] <= 0 || periods[p] > MAXFRAMES)) {
+          continue;
+          }
+        if ((pid = fork ()) == 0) {
+          bench_rate = rates[r];
+          bench_voices = voices[v];
+          if (bench_loopback) {
+            bench_period = periods[p];
+            printf ("%6u %6u %9u\n", bench_rate, bench_period,
+                    loop_delay > bench_period ? loop_delay : bench_period);
+            fflush (stdout);
+            }
+          optind = 0;  /* 0 makes glibc re-read the option string, e.g. a leading + */
+          exit (tool_main (argc, argv));
+          }
+        if (pid < 0 || waitpid (pid, &status, 0) < 0 || !WIFEXITED (status) || WEXITSTATUS (status)) {
+          failed = 1;
+          }
+        }
+      }
+    }
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* ---- client ---- */
+
+jack_client_t *jack_client_open (const char *client_name, jack_options_t options, jack_status_t *status, ...)
+{
+  snprintf (the_client.name, sizeof (the_client.name), "%s", client_name);
+  return &the_client;
+}
+
+int jack_client_close (jack_client_t *client)
+{
+  return 0;
+}
+
+int jack_activate (jack_client_t *client)
+{
+  if (process_cb == NULL) {
+    fprintf (stderr, "bench: no process callback\n");
+    exit (EXIT_FAILURE);
+    }
+  if (bench_loopback) {
+    loop_open ();
+    loop_running = 1;
+    return pthread_create (&loop_thread, NULL, loop_driver, NULL);
+    }
+  exit (bench_run () ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+int jack_deactivate (jack_client_t *client)
+{
+  if (loop_running) {
+    loop_running = 0;
+    pthread_join (loop_thread, NULL);
+    }
+  return 0;
+}
+
+int jack_set_process_callback (jack_client_t *client, JackProcessCallback cb, void *arg)
+{
+  process_cb = cb;
+  process_arg = arg;
+  return 0;
+}
+
+int jack_set_thread_init_callback (jack_client_t *client, JackThreadInitCallback cb, void *arg)
+{
+  thread_init_cb = cb;
+  thread_init_arg = arg;
+  return 0;
+}
+
+int jack_set_buffer_size_callback (jack_client_t *client, JackBufferSizeCallback cb, void *arg)
+{
+  buffer_size_cb = cb;
+  buffer_size_arg = arg;
+  return 0;
+}
+
+int jack_set_xrun_callback (jack_client_t *client, JackXRunCallback cb, void *arg)
+{
+  return 0;
+}
+
+void jack_on_shutdown (jack_client_t *client, JackShutdownCallback cb, void *arg)
+{
+}
+
+void jack_set_error_function (void (*func)(const char *))
+{
+}
+
+jack_nframes_t jack_get_sample_rate (jack_client_t *client)
+{
+  return bench_rate;
+}
+
+jack_nframes_t jack_get_buffer_size (jack_client_t *client)
+{
+  return bench_period;
+}
+
+jack_nframes_t jack_frame_time (const jack_client_t *client)
+{
+  return frame_clock;
+}
+
+jack_nframes_t jack_last_frame_time (const jack_client_t *client)
+{
+  return frame_clock;
+}
+
+void jack_free (void *ptr)
+{
+  free (ptr);
+}
+
+/* ---- ports ---- */
+
+jack_port_t *jack_port_register (jack_client_t *client, const char *port_name, const char *port_type, unsigned long flags, unsigned long buffer_size)
+{
+  jack_port_t *p;
+
+  if (nports == MAXPORTS) {
+    return NULL;
+    }
+  p = &ports[nports++];
+  snprintf (p->name, sizeof (p->name), "%s:%s", client->name, port_name);
+  p->midi = strcmp (port_type, JACK_DEFAULT_MIDI_TYPE) == 0;
+  p->flags = flags;
+  return p;
+}
+
+void *jack_port_get_buffer (jack_port_t *port, jack_nframes_t nframes)
+{
+  return port->midi ? (void *) &port->mbuf : (void *) port->audio;
+}
+
+const char *jack_port_name (const jack_port_t *port)
+{
+  return port->name;
+}
+
+/* pretend there is one port of every kind out there, so auto-connects succeed */
+const char **jack_get_ports (jack_client_t *client, const char *port_name_pattern, const char *type_name_pattern, unsigned long flags)
+{
+  const char **list = malloc (3 * sizeof (char *));
+
+  list[0] = "system:port_1";
+  list[1] = "system:port_2";
+  list[2] = NULL;
+  return list;
+}
+
+int jack_connect (jack_client_t *client, const char *source_port, const char *destination_port)
+{
+  return 0;
+}
+
+/* ---- midi ---- */
+
+uint32_t jack_midi_get_event_count (void *port_buffer)
+{
+  return ((midibuf *) port_buffer)->count;
+}
+
+int jack_midi_event_get (jack_midi_event_t *event, void *port_buffer, uint32_t event_index)
+{
+  midibuf *m = port_buffer;
+
+  if (event_index >= m->count) {
+    return -1;
+    }
+  *event = m->ev[event_index];
+  return 0;
+}
+
+void jack_midi_clear_buffer (void *port_buffer)
+{
+  ((midibuf *) port_buffer)->count = 0;
+}
+
+int jack_midi_event_write (void *port_buffer, jack_nframes_t time, const jack_midi_data_t *data, size_t data_size)
+{
+  midibuf *m = port_buffer;
+
+  if (m->count == MAXEVENTS || data_size > sizeof (m->data[0])) {
+    return -1;
+    }
+  memcpy (m->data[m->count], data, data_size);
+  m->ev[m->count].time = time;
+  m->ev[m->count].size = data_size;
+  m->ev[m->count].buffer = m->data[m->count];
+  m->count++;
+  return 0;
+}
+
+/* ---- transport: always rolling from frame 0 at the start of the run,
+   with the tool's own timebase callback filling in the position ---- */
+
+jack_transport_state_t jack_transport_query (const jack_client_t *client, jack_position_t *pos)
+{
+  if (pos) {
+    memset (pos, 0, sizeof (*pos));
+    pos->frame = frame_clock;
+    pos->frame_rate = bench_rate;
+    if (timebase_cb) {
+      timebase_cb (JackTransportRolling, bench_period, pos, 0, timebase_arg);
+      }
+    }
+  return JackTransportRolling;
+}
+
+int jack_set_timebase_callback (jack_client_t *client, int conditional, JackTimebaseCallback cb, void *arg)
+{
+  timebase_cb = cb;
+  timebase_arg = arg;
+  return 0;
+}
+
+int jack_release_timebase (jack_client_t *client)
+{
+  timebase_cb = NULL;
+  return 0;
+}
+
+/* ---- threads ---- */
+
+int jack_client_real_time_priority (jack_client_t *client)
+{
+  return -1;
+}
+
+int jack_client_create_thread (jack_client_t *client, jack_native_thread_t *thread, int priority, int realtime, void *(*start_routine)(void *), void *arg)
+{
+  return pthread_create (thread, NULL, start_routine, arg);
+}
+
+/* ---- ringbuffer, same semantics as libjack's ---- */
+
+jack_ringbuffer_t *jack_ringbuffer_create (size_t sz)
+{
+  jack_ringbuffer_t *rb = calloc (1, sizeof (jack_ringbuffer_t));
+  int power_of_two;
+
+  for (power_of_two = 1; 1u << power_of_two < sz; power_of_two++);
+  rb->size = 1 << power_of_two;
+  rb->size_mask = rb->size - 1;
+  rb->buf = malloc (rb->size);
+  return rb;
+}
+
+void jack_ringbuffer_free (jack_ringbuffer_t *rb)
+{
+  free (rb->buf);
+  free (rb);
+}
+
+int jack_ringbuffer_mlock (jack_ringbuffer_t *rb)
+{
+  return 0;
+}
+
+void jack_ringbuffer_reset (jack_ringbuffer_t *rb)
+{
+  rb->read_ptr = rb->write_ptr = 0;
+}
+
+size_t jack_ringbuffer_read_space (const jack_ringbuffer_t *rb)
+{
+  return (rb->write_ptr - rb->read_ptr) & rb->size_mask;
+}
+
+size_t jack_ringbuffer_write_space (const jack_ringbuffer_t *rb)
+{
+  return (rb->read_ptr - rb->write_ptr - 1) & rb->size_mask;
+}
+
+static size_t rb_copy (char *dst, const char *src, size_t pos, size_t cnt, size_t size, int to_rb)
+{
+  size_t n1 = cnt, n2 = 0;
+
+  if (pos + cnt > size) {
+    n1 = size - pos;
+    n2 = cnt - n1;
+    }
+  if (to_rb) {
+    memcpy (dst + pos, src, n1);
+    memcpy (dst, src + n1, n2);
+  } else {
+    memcpy (dst, src + pos, n1);
+    memcpy (dst + n1, src, n2);
+    }
+  return cnt;
+}
+
+size_t jack_ringbuffer_read (jack_ringbuffer_t *rb, char *dest, size_t cnt)
+{
+  size_t avail = jack_ringbuffer_read_space (rb);
+
+  cnt = cnt < avail ? cnt : avail;
+  rb_copy (dest, rb->buf, rb->read_ptr, cnt, rb->size, 0);
+  __atomic_store_n (&rb->read_ptr, (rb->read_ptr + cnt) & rb->size_mask, __ATOMIC_RELEASE);
+  return cnt;
+}
+
+size_t jack_ringbuffer_peek (jack_ringbuffer_t *rb, char *dest, size_t cnt)
+{
+  size_t avail = jack_ringbuffer_read_space (rb);
+
+  cnt = cnt < avail ? cnt : avail;
+  return rb_copy (dest, rb->buf, rb->read_ptr, cnt, rb->size, 0);
+}
+
+void jack_ringbuffer_read_advance (jack_ringbuffer_t *rb, size_t cnt)
+{
+  __atomic_store_n (&rb->read_ptr, (rb->read_ptr + cnt) & rb->size_mask, __ATOMIC_RELEASE);
+}
+
+size_t jack_ringbuffer_write (jack_ringbuffer_t *rb, const char *src, size_t cnt)
+{
+  size_t avail = jack_ringbuffer_write_space (rb);
+
+  cnt = cnt < avail ? cnt : avail;
+  rb_copy (rb->buf, src, rb->write_ptr, cnt, rb->size, 1);
+  __atomic_store_n (&rb->write_ptr, (rb->write_ptr + cnt) & rb->size_mask, __ATOMIC_RELEASE);
+  return cnt;
+}
+
+void jack_ringbuffer_write_advance (jack_ringbuffer_t *rb, size_t cnt)
+{
+  __atomic_store_n (&rb->write_ptr, (rb->write_ptr + cnt) & rb->size_mask, __ATOMIC_RELEASE);
+}
+
+void jack_ringbuffer_get_read_vector (const jack_ringbuffer_t *rb, jack_ringbuffer_data_t *vec)
+{
+  size_t avail = jack_ringbuffer_read_space (rb);
+  size_t pos = rb->read_ptr;
+
+  vec[0].buf = rb->buf + pos;
+  if (pos + avail > rb->size) {
+    vec[0].len = rb->size - pos;
+    vec[1].buf = rb->buf;
+    vec[1].len = avail - vec[0].len;
+  } else {
+    vec[0].len = avail;
+    vec[1].buf = rb->buf;
+    vec[1].len = 0;
+    }
+}
+
+void jack_ringbuffer_get_write_vector (const jack_ringbuffer_t *rb, jack_ringbuffer_data_t *vec)
+{
+  size_t avail = jack_ringbuffer_write_space (rb);
+  size_t pos = rb->write_ptr;
+
+  vec[0].buf = rb->buf + pos;
+  if (pos + avail > rb->size) {
+    vec[0].len = rb->size - pos;
+    vec[1].buf = rb->buf;
+    vec[1].len = avail - vec[0].len;
+  } else {
+    vec[0].len = avail;
+    vec[1].buf = rb->buf;
+    vec[1].len = 0;
+    }
+}
@@ -9,50 +9,105 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
 
 #include <jack/jack.h>
+#include <jack/midiport.h>
 #include <math.h>
 
-jack_port_t *input_port;
-jack_port_t *output_port;
+#include "dspstat.h"
+#include "bqcascade.h"
+#include "denormal.h"
 
-//init
-static double mX1 = 0;
-static double mX2 = 0;
-static double mY1 = 0;
-static double mY2 = 0;
-static double pi = 22/7;
+#define BLOCKLEN 32     /* coefficients are recomputed at most once per block */
+#define SMOOTH_MS 20.0  /* time constant of the cutoff/resonance glide */
 
-static double cutoff;
+#define CC_RESONANCE 71
+#define CC_CUTOFF 74
+
+#define MIN_CUTOFF 20.0
+#define MAX_CUTOFF 20000.0
+#define MIN_RES -25.0
+#define MAX_RES 25.0
+
+#define MAXCHANNELS 64
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+jack_port_t *input_port[MAXCHANNELS];
+jack_port_t *output_port[MAXCHANNELS];
+jack_port_t *midi_port;
+
+static int nchannels = 1;
+static int nsections = 1;
+static bqcascade *bq;
+
+/* target parameters (set from argv and MIDI) and the smoothed values the
+   current coefficients were computed from */
+static double cutoff, res = 6;
+static double cur_cutoff, cur_res;
+static double smooth;
 
 static double sr;
 
-double biquad_filter(double input, double cutoff, double res)
+static void biquad_coefs (bqcoefs *c, double cutoff, double res)
 {
   //res_slider range -25/25db
 
   cutoff = 2 * cutoff / sr;
   res = pow(10, 0.05 * -res);
-  double k = 0.5 * res * sin(pi * cutoff);
+  double k = 0.5 * res * sin(M_PI * cutoff);
   double c1 = 0.5 * (1 - k) / (1 + k);
-  double c2 = (0.5 + c1) * cos(pi * cutoff);
+  double c2 = (0.5 + c1) * cos(M_PI * cutoff);
   double c3 = (0.5 + c1 - c2) * 0.25;
-    
-  double mA0 = 2 * c3;
-  double mA1 = 2 * 2 * c3;
-  double mA2 = 2 * c3;
-  double mB1 = 2 * -c2;
-  double mB2 = 2 * c1;
-
-  //loop
-  double output = mA0*input + mA1*mX1 + mA2*mX2 - mB1*mY1 - mB2*mY2;
-
-  mX2 = mX1;
-  mX1 = input;
-  mY2 = mY1;
-  mY1 = output;
-
-  return output;
+
+  c->a0 = 2 * c3;
+  c->a1 = 2 * 2 * c3;
+  c->a2 = 2 * c3;
+  c->b1 = 2 * -c2;
+  c->b2 = 2 * c1;
+}
+
+static double clamp (double x, double lo, double hi)
+{
+  return x < lo ? lo : x > hi ? hi : x;
+}
+
+static void handlecc (const jack_midi_data_t *b)
+{
+  if ((b[0] & 0xf0) != 0xb0) {
+    return;
+    }
+  switch (b[1]) {
+    case CC_CUTOFF:
+      /* exponential over MIN_CUTOFF..MAX_CUTOFF */
+      cutoff = MIN(MIN_CUTOFF * pow (MAX_CUTOFF / MIN_CUTOFF, b[2] / 127.0), 0.49 * sr);
+      break;
+    case CC_RESONANCE:
+      res = MIN_RES + (MAX_RES - MIN_RES) * b[2] / 127.0;
+      break;
+    }
+}
+
+/* glide the smoothed parameters one block towards their targets; returns
+   nonzero when the coefficients need recomputing */
+static int smooth_params (void)
+{
+  const double dc = cutoff - cur_cutoff, dr = res - cur_res;
+
+  if (dc == 0 && dr == 0) {
+    return 0;
+    }
+  /* snap once within a hundredth of a cent / dB, so idle blocks stay free */
+  if (fabs (dc) < cur_cutoff * 6e-6 && fabs (dr) < 0.01) {
+    cur_cutoff = cutoff;
+    cur_res = res;
+    }
+  else {
+    cur_cutoff += smooth * dc;
+    cur_res += smooth * dr;
+    }
+  return 1;
 }
 
 
@@ -63,15 +118,49 @@ double biquad_filter(double input, double cutoff, double res)
 int
 process (jack_nframes_t nframes, void *arg)
 {
-  int i;
+  const uint64_t t0 = dspstat_begin ();
+  jack_default_audio_sample_t *in[MAXCHANNELS], *out[MAXCHANNELS];
+  const float *bin[MAXCHANNELS];
+  float *bout[MAXCHANNELS];
+  jack_nframes_t done = 0;
+  jack_midi_event_t event;
+  uint32_t e = 0, nev;
+  int c;
+
+  for (c=0; c<nchannels; c++) {
+    in[c] = (jack_default_audio_sample_t *) jack_port_get_buffer (input_port[c], nframes);
+    out[c] = (jack_default_audio_sample_t *) jack_port_get_buffer (output_port[c], nframes);
+    }
+  void *midibuf = jack_port_get_buffer (midi_port, nframes);
+
+  nev = jack_midi_get_event_count (midibuf);
 
-  jack_default_audio_sample_t *out = (jack_default_audio_sample_t *) jack_port_get_buffer (output_port, nframes);
-  jack_default_audio_sample_t *in = (jack_default_audio_sample_t *) jack_port_get_buffer (input_port, nframes);
+  while (done < nframes) {
+    const int n = MIN(BLOCKLEN, nframes - done);
 
-  for(i=0; i<nframes; i++) {
-    out[i] = biquad_filter(in[i],cutoff,6);
+    /* controller changes take effect at the block they fall in */
+    while (e < nev && jack_midi_event_get (&event, midibuf, e) == 0 && event.time < done + n) {
+      if (event.size == 3) {
+        handlecc (event.buffer);
+        }
+      e++;
+      }
+    if (smooth_params ()) {
+      bqcoefs to;
+      biquad_coefs (&to, cur_cutoff, cur_res);
+      for (c=0; c<nsections; c++) {
+        bq_set (bq, c, &to);
+        }
+      }
+    for (c=0; c<nchannels; c++) {
+      bin[c] = in[c] + done;
+      bout[c] = out[c] + done;
+      }
+    bq_process (bq, bin, bout, n);
+    done += n;
     }
-        
+
+  dspstat_end (t0, nframes);
   return 0;      
 }
 
@@ -87,19 +176,53 @@ jack_shutdown (void *arg)
         exit (1);
 }
 
+static volatile sig_atomic_t keeprunning = 1;
+
+static void
+wearedone (int sig)
+{
+        keeprunning = 0;
+}
+
 int
 main (int argc, char *argv[])
 {
         jack_client_t *client;
         const char **ports;
-        int i;
-
-        if (argc != 2) {
-          printf("cutoff?\n");
+        bqcoefs c;
+        int i, j, opt;
+
+        while ((opt = getopt (argc, argv, "c:s:")) != -1) {
+          switch (opt) {
+            case 'c':
+              nchannels = atoi (optarg);
+              break;
+            case 's':
+              nsections = atoi (optarg);
+              break;
+            default:
+              argc = 0;
+              break;
+            }
+          }
+        if (argc - optind < 1 || argc - optind > 2 || nchannels < 1 || nchannels > MAXCHANNELS || nsections < 1) {
+          printf("usage: biquad [-c channels] [-s sections] cutoff [resonance]\n");
+          printf("  -c N   filter N channels (1-%d) in one client\n", MAXCHANNELS);
+          printf("  -s M   cascade M identical sections per channel for a steeper slope\n");
+          printf("CC%d sets cutoff (%.0f-%.0fHz), CC%d resonance (%.0f to %.0fdB).\n",
+                 CC_CUTOFF, MIN_CUTOFF, MAX_CUTOFF, CC_RESONANCE, MIN_RES, MAX_RES);
           exit(0);
           }
 
-        cutoff = atof(argv[1]);
+        cutoff = atof(argv[optind]);
+        if (argc - optind == 2) {
+          res = clamp (atof(argv[optind + 1]), MIN_RES, MAX_RES);
+          }
+
+        if ((bq = bq_create (nchannels, nsections)) == NULL) {
+                fprintf (stderr, "cannot allocate filters\n");
+                return 1;
+        }
 
         /* try to become a client of the JACK server */
 
@@ -113,6 +236,7 @@ main (int argc, char *argv[])
         */
 
         jack_set_process_callback (client, process, 0);
+        jack_set_thread_init_callback (client, denormal_thread_init, 0);
 
         /* tell the JACK server to call `jack_shutdown()' if
            it ever shuts down, either entirely, or if it
@@ -121,6 +245,10 @@ main (int argc, char *argv[])
 
         jack_on_shutdown (client, jack_shutdown, 0);
 
+        dspstat_init (client, "biquad");
+        /* the report socket goes on every exit, errors and shutdown included */
+        atexit (dspstat_close);
+
         /* display the current sample rate. 
          */
 
@@ -128,10 +256,34 @@ main (int argc, char *argv[])
 
         printf ("engine sample rate: %f\n", sr);
 
-        /* create two ports */
+        /* start settled on the command line values */
+        cutoff = clamp (cutoff, MIN_CUTOFF, MIN(MAX_CUTOFF, 0.49 * sr));
+        cur_cutoff = cutoff;
+        cur_res = res;
+        biquad_coefs (&c, cur_cutoff, cur_res);
+        for (i=0; i<nsections; i++) {
+          bq_set (bq, i, &c);
+          }
+        bq_snap (bq);
+        smooth = 1 - exp (-BLOCKLEN / (SMOOTH_MS * 0.001 * sr));
+
+        /* create the ports */
 
-        input_port = jack_port_register (client, "input", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
-        output_port = jack_port_register (client, "output", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+        midi_port = jack_port_register (client, "control", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+        if (nchannels == 1) {
+          input_port[0] = jack_port_register (client, "input", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+          output_port[0] = jack_port_register (client, "output", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+          }
+        else {
+          for (i=0; i<nchannels; i++) {
+            char name[32];
+            sprintf (name, "input_%d", i + 1);
+            input_port[i] = jack_port_register (client, name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+            sprintf (name, "output_%d", i + 1);
+            output_port[i] = jack_port_register (client, name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+            }
+          }
+        printf ("%d channel(s) x %d section(s), %d channels per SIMD register\n", nchannels, nsections, bq_lanes ());
 
         /* tell the JACK server that we are ready to roll */
 
@@ -140,6 +292,10 @@ main (int argc, char *argv[])
                 return 1;
         }
 
+        signal (SIGHUP, wearedone);
+        signal (SIGINT, wearedone);
+        signal (SIGTERM, wearedone);
+
         /* connect the ports. Note: you can't do this before
            the client is activated, because we can't allow
            connections to be made to clients that aren't
@@ -151,11 +307,11 @@ main (int argc, char *argv[])
                 exit(1);
         }
 
-        i = 0;
+        i = j = 0;
         while(ports[i] != NULL) {
           if (strstr(ports[i], "jsynthosc")) { 
             printf("connecting %s\n", ports[i]);
-            if (jack_connect (client, ports[i], jack_port_name (input_port))) {
+            if (jack_connect (client, ports[i], jack_port_name (input_port[j++ % nchannels]))) {
               fprintf (stderr, "cannot connect input ports\n");
               }
             }
@@ -169,17 +325,20 @@ main (int argc, char *argv[])
                 exit(1);
         }
 
-        if (jack_connect (client, jack_port_name (output_port), ports[0])) {
+        for (i=0; i<nchannels && ports[i] != NULL; i++) {
+          if (jack_connect (client, jack_port_name (output_port[i]), ports[i])) {
                 fprintf (stderr, "cannot connect output ports\n");
-        }
+            }
+          }
 
         free (ports);
 
         /* Since this is just a toy, run for a few seconds, then finish */
 
-        while(1){
+        while (keeprunning) {
           sleep (10);
           }
         jack_client_close (client);
+        bq_free (bq);
         exit (0);
 }
@@ -0,0 +1,211 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bqcascade.h"
+#include "denormal.h"
+
+#ifdef __AVX__
+#define LANES 8
+#else
+#define LANES 4
+#endif
+#define VBYTES (LANES * sizeof(float))
+
+/* frames transposed into lanes per pass; the block stays in L1 while
+   every section runs over it */
+#define BQ_BLOCK 64
+
+typedef float vf __attribute__ ((vector_size (VBYTES)));
+typedef int vi __attribute__ ((vector_size (VBYTES)));
+
+/* one section for LANES channels: current and target coefficients and
+   the transposed direct form II state */
+typedef struct {
+  vf a0, a1, a2, b1, b2;
+  vf t0, t1, t2, u1, u2;
+  vf s1, s2;
+  } bqsect;
+
+struct bqcascade {
+  int channels, sections, groups;
+  int ramp;         /* targets differ from the current coefficients */
+  bqsect *sect;     /* [group * sections + section] */
+  };
+
+int bq_lanes (void)
+{
+  return LANES;
+}
+
+bqcascade *bq_create (int channels, int sections)
+{
+  bqcascade *bq;
+  void *p;
+
+  if (channels < 1 || sections < 1 || (bq = calloc (1, sizeof(bqcascade))) == NULL) {
+    return NULL;
+    }
+  bq->channels = channels;
+  bq->sections = sections;
+  bq->groups = (channels + LANES - 1) / LANES;
+  if (posix_memalign (&p, VBYTES, bq->groups * sections * sizeof(bqsect))) {
+    free (bq);
+    return NULL;
+    }
+  bq->sect = p;
+  memset (bq->sect, 0, bq->groups * sections * sizeof(bqsect));
+  return bq;
+}
+
+void bq_free (bqcascade *bq)
+{
+  if (bq) {
+    free (bq->sect);
+    free (bq);
+    }
+}
+
+static void set_lane (bqsect *s, int lane, const bqcoefs *c)
+{
+  s->t0[lane] = c->a0;
+  s->t1[lane] = c->a1;
+  s->t2[lane] = c->a2;
+  s->u1[lane] = c->b1;
+  s->u2[lane] = c->b2;
+}
+
+void bq_set_channel (bqcascade *bq, int channel, int section, const bqcoefs *c)
+{
+  set_lane (&bq->sect[(channel / LANES) * bq->sections + section], channel % LANES, c);
+  bq->ramp = 1;
+}
+
+void bq_set (bqcascade *bq, int section, const bqcoefs *c)
+{
+  int ch;
+
+  for (ch=0; ch<bq->channels; ch++) {
+    set_lane (&bq->sect[(ch / LANES) * bq->sections + section], ch % LANES, c);
+    }
+  bq->ramp = 1;
+}
+
+void bq_snap (bqcascade *bq)
+{
+  int i;
+
+  for (i=0; i<bq->groups * bq->sections; i++) {
+    bqsect *s = &bq->sect[i];
+    s->a0 = s->t0; s->a1 = s->t1; s->a2 = s->t2; s->b1 = s->u1; s->b2 = s->u2;
+    }
+  bq->ramp = 0;
+}
+
+void bq_reset (bqcascade *bq)
+{
+  int i;
+
+  for (i=0; i<bq->groups * bq->sections; i++) {
+    bq->sect[i].s1 = bq->sect[i].s2 = (vf) {0};
+    }
+}
+
+/* zero the lanes of s that have decayed below DENORMAL_FLOOR */
+static inline vf flush (vf s)
+{
+  const vf f = (vf) {0} + DENORMAL_FLOOR;
+
+  return (vf) ((vi) s & ((s > f) | (s < -f)));
+}
+
+/* run one section over len transposed frames; static coefficients */
+static void section_run (bqsect *s, vf *x, int len)
+{
+  const vf a0 = s->a0, a1 = s->a1, a2 = s->a2, b1 = s->b1, b2 = s->b2;
+  vf s1 = s->s1, s2 = s->s2;
+  int i;
+
+  for (i=0; i<len; i++) {
+    const vf in = x[i];
+    const vf y = a0 * in + s1;
+    s1 = a1 * in - b1 * y + s2;
+    s2 = a2 * in - b2 * y;
+    x[i] = y;
+    }
+  s->s1 = flush (s1);
+  s->s2 = flush (s2);
+}
+
+/* the same with the coefficients stepping by d per frame */
+static void section_ramp (bqsect *s, const vf *d, vf *x, int len)
+{
+  vf a0 = s->a0, a1 = s->a1, a2 = s->a2, b1 = s->b1, b2 = s->b2;
+  vf s1 = s->s1, s2 = s->s2;
+  int i;
+
+  for (i=0; i<len; i++) {
+    a0 += d[0]; a1 += d[1]; a2 += d[2]; b1 += d[3]; b2 += d[4];
+    const vf in = x[i];
+    const vf y = a0 * in + s1;
+    s1 = a1 * in - b1 * y + s2;
+    s2 = a2 * in - b2 * y;
+    x[i] = y;
+    }
+  s->a0 = a0; s->a1 = a1; s->a2 = a2; s->b1 = b1; s->b2 = b2;
+  s->s1 = flush (s1);
+  s->s2 = flush (s2);
+}
+
+void bq_process (bqcascade *bq, const float *const *in, float *const *out, int n)
+{
+  vf x[BQ_BLOCK] __attribute__ ((aligned (32)));
+  const int ramp = bq->ramp && n > 0;
+  int g, k, off, l;
+
+  for (g=0; g<bq->groups; g++) {
+    bqsect *sect = &bq->sect[g * bq->sections];
+    const int ch0 = g * LANES;
+    const int nl = bq->channels - ch0 < LANES ? bq->channels - ch0 : LANES;
+
+    for (off=0; off<n; off+=BQ_BLOCK) {
+      const int len = n - off < BQ_BLOCK ? n - off : BQ_BLOCK;
+      int i;
+
+      /* transpose this group's channels into lanes; spare lanes run silence */
+      if (nl < LANES) {
+        memset (x, 0, len * sizeof(vf));
+        }
+      for (l=0; l<nl; l++) {
+        const float *src = in[ch0 + l] + off;
+        for (i=0; i<len; i++) {
+          x[i][l] = src[i];
+          }
+        }
+
+      for (k=0; k<bq->sections; k++) {
+        bqsect *s = &sect[k];
+        if (ramp) {
+          /* per frame step, recomputed from what is left of the ramp */
+          const vf left = (vf) {0} + (float) (n - off);
+          const vf d[5] = { (s->t0 - s->a0) / left, (s->t1 - s->a1) / left, (s->t2 - s->a2) / left,
+                            (s->u1 - s->b1) / left, (s->u2 - s->b2) / left };
+          section_ramp (s, d, x, len);
+          }
+        else {
+          section_run (s, x, len);
+          }
+        }
+
+      for (l=0; l<nl; l++) {
+        float *dst = out[ch0 + l] + off;
+        for (i=0; i<len; i++) {
+          dst[i] = x[i][l];
+          }
+        }
+      }
+    }
+  if (ramp) {
+    /* land exactly on the targets */
+    bq_snap (bq);
+    }
+}
@@ -0,0 +1,41 @@
+/*
+ * Multichannel biquad cascade shared by the jack tools.  Every channel
+ * runs the same number of second-order sections with its own state;
+ * channels are packed into SIMD lanes (4 per SSE register, 8 with AVX)
+ * so a whole bus costs about as much as one channel per lane group.
+ */
+
+#ifndef BQCASCADE_H
+#define BQCASCADE_H
+
+/* y = a0 x + a1 x[-1] + a2 x[-2] - b1 y[-1] - b2 y[-2] */
+typedef struct {
+  float a0, a1, a2, b1, b2;
+  } bqcoefs;
+
+typedef struct bqcascade bqcascade;
+
+/* channels x sections, all coefficients zero; NULL if out of memory */
+bqcascade *bq_create (int channels, int sections);
+void bq_free (bqcascade *bq);
+
+/* set the target coefficients of one section, on every channel or on
+   just one.  The next bq_process() ramps to them linearly over its
+   frames, so call it once per control block. */
+void bq_set (bqcascade *bq, int section, const bqcoefs *c);
+void bq_set_channel (bqcascade *bq, int channel, int section, const bqcoefs *c);
+
+/* jump straight to the target coefficients, without a ramp */
+void bq_snap (bqcascade *bq);
+
+/* clear the filter state on every channel */
+void bq_reset (bqcascade *bq);
+
+/* filter n frames from in[channel] to out[channel]; in and out may be
+   the same buffers */
+void bq_process (bqcascade *bq, const float *const *in, float *const *out, int n);
+
+/* channels per SIMD register in this build */
+int bq_lanes (void);
+
+#endif
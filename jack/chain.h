@@ -0,0 +1,59 @@
+/*
+ * In-process DSP nodes for dspchain.
+ *
+ * A node is one of the ordinary tools built as a shared object with
+ * -Dmain=tool_main and chainnode.c standing in for libjack, linked with
+ * -Bsymbolic so the tool's JACK calls bind to that stand-in even though
+ * the host has the real libjack loaded.  The stand-in records the ports
+ * and callbacks the tool registers in its chain_node; jack_activate()
+ * hands control back to the host and never returns, so the tool's own
+ * auto-connects never run.
+ *
+ * The host fills in chain_node.host before calling tool_main, then on
+ * every cycle points each port's buf at a scratch or real JACK buffer
+ * and calls the node's process callback.
+ */
+
+#ifndef CHAIN_H
+#define CHAIN_H
+
+#include <semaphore.h>
+#include <jack/jack.h>
+
+#define CHAIN_MAXPORTS (64)
+
+typedef struct {
+  char name[64];          /* short name, as registered */
+  char fullname[128];     /* node:name, for jack_port_name() */
+  int midi;
+  unsigned long flags;
+  void *buf;              /* returned by jack_port_get_buffer(), set by the host */
+  } chain_port;
+
+/* the real client, and the few client calls a node may need passed through */
+typedef struct {
+  jack_client_t *client;
+  jack_nframes_t rate;
+  sem_t ready;            /* posted when a node activates or its main returns */
+  jack_nframes_t (*buffer_size) (jack_client_t *client);
+  jack_nframes_t (*frame_time) (const jack_client_t *client);
+  jack_nframes_t (*last_frame_time) (const jack_client_t *client);
+  jack_transport_state_t (*transport_query) (const jack_client_t *client, jack_position_t *pos);
+  int (*real_time_priority) (jack_client_t *client);
+  int (*create_thread) (jack_client_t *client, jack_native_thread_t *thread, int priority,
+                        int realtime, void *(*start_routine)(void *), void *arg);
+  } chain_host;
+
+typedef struct {
+  chain_host *host;
+  char name[64];
+  int active;
+  JackProcessCallback process;
+  void *process_arg;
+  JackThreadInitCallback thread_init;
+  void *thread_init_arg;
+  int nports;
+  chain_port port[CHAIN_MAXPORTS];
+  } chain_node;
+
+#endif
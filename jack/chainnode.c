@@ -0,0 +1,155 @@
+/*
+ * libjack stand-in linked into every dspchain node, see chain.h.
+ *
+ * Ports are entries in chain_this.port whose buffers the host points
+ * at, callbacks are recorded for the host to call, and the calls that
+ * need the real client (transport, frame time, RT threads) go through
+ * chain_this.host.  Everything else a tool uses (MIDI buffers,
+ * ringbuffers) is client-free and resolves to the host's libjack.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <jack/jack.h>
+#include <jack/thread.h>
+
+#include "chain.h"
+
+struct _jack_client {
+  char name[64];
+  };
+
+/* looked up by the host with dlsym() */
+chain_node chain_this;
+
+static struct _jack_client the_client;
+
+/* ---- client ---- */
+
+jack_client_t *jack_client_open (const char *client_name, jack_options_t options, jack_status_t *status, ...)
+{
+  if (chain_this.host == NULL) {
+    return NULL;
+    }
+  snprintf (the_client.name, sizeof (the_client.name), "%s", chain_this.name);
+  return &the_client;
+}
+
+int jack_client_close (jack_client_t *client)
+{
+  return 0;
+}
+
+/* the node is wired up: give control back to the host for good */
+int jack_activate (jack_client_t *client)
+{
+  chain_this.active = 1;
+  sem_post (&chain_this.host->ready);
+  for (;;) {
+    pause ();
+    }
+}
+
+int jack_deactivate (jack_client_t *client)
+{
+  return 0;
+}
+
+int jack_set_process_callback (jack_client_t *client, JackProcessCallback cb, void *arg)
+{
+  chain_this.process = cb;
+  chain_this.process_arg = arg;
+  return 0;
+}
+
+int jack_set_thread_init_callback (jack_client_t *client, JackThreadInitCallback cb, void *arg)
+{
+  chain_this.thread_init = cb;
+  chain_this.thread_init_arg = arg;
+  return 0;
+}
+
+/* the host's own dspstat counts the xruns */
+int jack_set_xrun_callback (jack_client_t *client, JackXRunCallback cb, void *arg)
+{
+  return 0;
+}
+
+void jack_on_shutdown (jack_client_t *client, JackShutdownCallback cb, void *arg)
+{
+}
+
+jack_nframes_t jack_get_sample_rate (jack_client_t *client)
+{
+  return chain_this.host->rate;
+}
+
+jack_nframes_t jack_get_buffer_size (jack_client_t *client)
+{
+  return chain_this.host->buffer_size (chain_this.host->client);
+}
+
+jack_nframes_t jack_frame_time (const jack_client_t *client)
+{
+  return chain_this.host->frame_time (chain_this.host->client);
+}
+
+jack_nframes_t jack_last_frame_time (const jack_client_t *client)
+{
+  return chain_this.host->last_frame_time (chain_this.host->client);
+}
+
+jack_transport_state_t jack_transport_query (const jack_client_t *client, jack_position_t *pos)
+{
+  return chain_this.host->transport_query (chain_this.host->client, pos);
+}
+
+int jack_client_real_time_priority (jack_client_t *client)
+{
+  return chain_this.host->real_time_priority (chain_this.host->client);
+}
+
+int jack_client_create_thread (jack_client_t *client, jack_native_thread_t *thread, int priority, int realtime, void *(*start_routine)(void *), void *arg)
+{
+  return chain_this.host->create_thread (chain_this.host->client, thread, priority, realtime, start_routine, arg);
+}
+
+/* ---- ports ---- */
+
+jack_port_t *jack_port_register (jack_client_t *client, const char *port_name, const char *port_type, unsigned long flags, unsigned long buffer_size)
+{
+  chain_port *p;
+
+  if (chain_this.nports == CHAIN_MAXPORTS) {
+    return NULL;
+    }
+  p = &chain_this.port[chain_this.nports++];
+  snprintf (p->name, sizeof (p->name), "%s", port_name);
+  snprintf (p->fullname, sizeof (p->fullname), "%s:%s", chain_this.name, port_name);
+  p->midi = strcmp (port_type, JACK_DEFAULT_MIDI_TYPE) == 0;
+  p->flags = flags;
+  return (jack_port_t *) p;
+}
+
+void *jack_port_get_buffer (jack_port_t *port, jack_nframes_t nframes)
+{
+  return ((chain_port *) port)->buf;
+}
+
+const char *jack_port_name (const jack_port_t *port)
+{
+  return ((const chain_port *) port)->fullname;
+}
+
+/* a node sees nothing outside itself; the host does the wiring */
+const char **jack_get_ports (jack_client_t *client, const char *port_name_pattern, const char *type_name_pattern, unsigned long flags)
+{
+  return NULL;
+}
+
+int jack_connect (jack_client_t *client, const char *source_port, const char *destination_port)
+{
+  return 0;
+}
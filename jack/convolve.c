@@ -0,0 +1,294 @@
+/** @file convolve.c
+ *
+ * @brief Convolution reverb: filters its input through an impulse
+ * response read from a WAV file, using uniformly partitioned FFT
+ * convolution so the cost of a period stays bounded however long the
+ * IR is.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jack/jack.h>
+#include <math.h>
+
+#include "dspstat.h"
+#include "denormal.h"
+#include "partconv.h"
+#include "wavfile.h"
+
+#define MAXBLOCK 8192
+
+jack_port_t *input_port;
+jack_port_t *output_port;
+
+static partconv *pc;
+static int block = 64;
+
+/* for periods that are not a multiple of the block, input collects here
+   and output comes out one block late */
+static float fifo_in[MAXBLOCK], fifo_out[MAXBLOCK];
+static int fifo_fill;
+/* which of the two, settled per period size and not per cycle */
+static int direct;
+
+/* exponentially decaying white noise, RT60 of secs, unit energy */
+static float *synthetic_ir (double secs, double sr, size_t *len)
+{
+  float *ir;
+  uint32_t seed = 1;
+  double energy = 0;
+  size_t i;
+
+  *len = secs * sr;
+  if (*len == 0 || (ir = malloc (*len * sizeof (float))) == NULL) {
+    return NULL;
+    }
+  for (i=0; i<*len; i++) {
+    seed = seed * 1664525 + 1013904223;
+    ir[i] = ((int32_t) seed >> 8) * (1.0f / (1 << 23)) * exp (-6.9 * i / (secs * sr));
+    energy += ir[i] * ir[i];
+    }
+  for (i=0; i<*len; i++) {
+    ir[i] /= sqrt (energy);
+    }
+  return ir;
+}
+
+/* the IR from a WAV file, mixed down to mono */
+static float *load_ir (const char *path, double sr, size_t *len)
+{
+  unsigned long rate;
+  int channels, c;
+  float *wav, *ir;
+  size_t i;
+
+  if ((wav = wav_read (path, &channels, &rate, len)) == NULL) {
+    return NULL;
+    }
+  if (rate != sr) {
+    fprintf (stderr, "warning: %s is %lu Hz and JACK runs at %.0f Hz; it is not resampled\n", path, rate, sr);
+    }
+  if (*len == 0 || (ir = malloc (*len * sizeof (float))) == NULL) {
+    free (wav);
+    return NULL;
+    }
+  for (i=0; i<*len; i++) {
+    ir[i] = 0;
+    for (c=0; c<channels; c++) {
+      ir[i] += wav[i * channels + c];
+      }
+    ir[i] /= channels;
+    }
+  free (wav);
+  return ir;
+}
+
+
+/**
+ * The process callback for this JACK application.
+ * It is called by JACK at the appropriate times.
+ */
+int
+process (jack_nframes_t nframes, void *arg)
+{
+  const uint64_t t0 = dspstat_begin ();
+  int i;
+
+  jack_default_audio_sample_t *out = (jack_default_audio_sample_t *) jack_port_get_buffer (output_port, nframes);
+  jack_default_audio_sample_t *in = (jack_default_audio_sample_t *) jack_port_get_buffer (input_port, nframes);
+
+  if (direct) {
+    /* no added latency: each block comes straight back out */
+    for (i=0; i<nframes; i+=block) {
+      partconv_process (pc, in + i, out + i);
+      }
+    }
+  else {
+    for (i=0; i<nframes; i++) {
+      out[i] = fifo_out[fifo_fill];
+      fifo_in[fifo_fill] = in[i];
+      if (++fifo_fill == block) {
+        partconv_process (pc, fifo_in, fifo_out);
+        fifo_fill = 0;
+        }
+      }
+    }
+
+  dspstat_end (t0, nframes);
+  return 0;
+}
+
+/**
+ * Called by JACK before the first cycle and whenever the period size
+ * changes, never while process() runs.  Switching paths mid-stream
+ * would play the FIFO's half-filled block against the direct path's
+ * state, so the choice is made here and the FIFO starts over silent.
+ */
+int
+buffer_size (jack_nframes_t nframes, void *arg)
+{
+  direct = nframes % block == 0;
+  memset (fifo_in, 0, sizeof (fifo_in));
+  memset (fifo_out, 0, sizeof (fifo_out));
+  fifo_fill = 0;
+  return 0;
+}
+
+/**
+ * This is the shutdown callback for this JACK application.
+ * It is called by JACK if the server ever shuts down or
+ * decides to disconnect the client.
+ */
+void
+jack_shutdown (void *arg)
+{
+
+        exit (1);
+}
+
+int
+main (int argc, char *argv[])
+{
+        jack_client_t *client;
+        const char **ports;
+        double synth = 0, gain = 0, sr;
+        float *ir;
+        size_t len;
+        int i, opt;
+
+        while ((opt = getopt (argc, argv, "b:g:n:")) != -1) {
+          switch (opt) {
+            case 'b':
+              block = atoi (optarg);
+              break;
+            case 'g':
+              gain = atof (optarg);
+              break;
+            case 'n':
+              synth = atof (optarg);
+              break;
+            default:
+              argc = 0;
+              break;
+            }
+          }
+        if (argc - optind != (synth > 0 ? 0 : 1) || block < 16 || block > MAXBLOCK || (block & (block - 1))) {
+          printf("usage: convolve [-b block] [-g gain] { ir.wav | -n seconds }\n");
+          printf("  -b N   partition size, a power of two from 16 to %d (default 64)\n", MAXBLOCK);
+          printf("  -g dB  output gain (default 0)\n");
+          printf("  -n S   use S seconds of decaying noise instead of an IR file\n");
+          exit(0);
+          }
+
+        /* try to become a client of the JACK server */
+
+        if ((client = jack_client_open("convolve", (jack_options_t)0, NULL)) == NULL) {
+                fprintf (stderr, "jack server not running?\n");
+                return 1;
+        }
+
+        /* tell the JACK server to call `process()' whenever
+           there is work to be done.
+        */
+
+        jack_set_process_callback (client, process, 0);
+        jack_set_buffer_size_callback (client, buffer_size, 0);
+        jack_set_thread_init_callback (client, denormal_thread_init, 0);
+
+        /* tell the JACK server to call `jack_shutdown()' if
+           it ever shuts down, either entirely, or if it
+           just decides to stop calling us.
+        */
+
+        jack_on_shutdown (client, jack_shutdown, 0);
+
+        dspstat_init (client, "convolve");
+
+        /* display the current sample rate.
+         */
+
+        sr = jack_get_sample_rate (client);
+
+        printf ("engine sample rate: %f\n", sr);
+
+        /* load and transform the IR now, before the process thread runs */
+
+        ir = synth > 0 ? synthetic_ir (synth, sr, &len) : load_ir (argv[optind], sr, &len);
+        if (ir == NULL) {
+                fprintf (stderr, "cannot load impulse response %s\n", synth > 0 ? "" : argv[optind]);
+                return 1;
+        }
+        for (i=0; i<len; i++) {
+          ir[i] *= pow (10, gain / 20);
+          }
+        if ((pc = partconv_create (ir, len, block)) == NULL) {
+                fprintf (stderr, "cannot allocate convolver\n");
+                return 1;
+        }
+        free (ir);
+
+        printf ("IR: %.2f s, %d partitions of %d frames; no added latency when the period is a multiple of %d, else %d frames\n",
+                len / sr, partconv_partitions (pc), block, block, block);
+
+        /* create two ports */
+
+        input_port = jack_port_register (client, "input", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+        output_port = jack_port_register (client, "output", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+
+        buffer_size (jack_get_buffer_size (client), 0);
+
+        /* tell the JACK server that we are ready to roll */
+
+        if (jack_activate (client)) {
+                fprintf (stderr, "cannot activate client");
+                return 1;
+        }
+
+        /* connect the ports. Note: you can't do this before
+           the client is activated, because we can't allow
+           connections to be made to clients that aren't
+           running.
+        */
+
+        if ((ports = jack_get_ports (client, NULL, NULL, JackPortIsOutput)) == NULL) {
+                fprintf(stderr, "Cannot find any physical capture ports\n");
+                exit(1);
+        }
+
+        i = 0;
+        while(ports[i] != NULL) {
+          if (strstr(ports[i], "jsynthosc")) {
+            printf("connecting %s\n", ports[i]);
+            if (jack_connect (client, ports[i], jack_port_name (input_port))) {
+              fprintf (stderr, "cannot connect input ports\n");
+              }
+            }
+            i++;
+          }
+
+        free (ports);
+
+        if ((ports = jack_get_ports (client, NULL, NULL, JackPortIsPhysical|JackPortIsInput)) == NULL) {
+                fprintf(stderr, "Cannot find any physical playback ports\n");
+                exit(1);
+        }
+
+        if (jack_connect (client, jack_port_name (output_port), ports[0])) {
+                fprintf (stderr, "cannot connect output ports\n");
+        }
+
+        free (ports);
+
+        /* Since this is just a toy, run for a few seconds, then finish */
+
+        while(1){
+          sleep (10);
+          }
+        jack_client_close (client);
+        partconv_free (pc);
+        exit (0);
+}
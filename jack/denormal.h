@@ -0,0 +1,45 @@
+/*
+ * Denormal handling shared by the jack tools.  Recursive filters and
+ * exponential envelopes decay into subnormal floats once their input
+ * goes silent, and on x86 each subnormal operation can cost a hundred
+ * cycles.  denormals_off() sets flush-to-zero and denormals-are-zero on
+ * the calling thread; hand denormal_thread_init to
+ * jack_set_thread_init_callback() so it runs on the process thread, and
+ * call denormals_off() at the top of any helper thread doing DSP.
+ */
+
+#ifndef DENORMAL_H
+#define DENORMAL_H
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+/* state smaller than this is as good as silence: 300dB down and far
+   above the subnormal range, so flushing it is inaudible */
+#define DENORMAL_FLOOR (1e-15f)
+
+static inline void denormals_off (void)
+{
+#if defined(__SSE__)
+  /* FTZ is bit 15, DAZ bit 6 of MXCSR */
+  _mm_setcsr (_mm_getcsr () | 0x8040);
+#elif defined(__aarch64__)
+  unsigned long fpcr;
+  __asm__ __volatile__ ("mrs %0, fpcr" : "=r" (fpcr));
+  __asm__ __volatile__ ("msr fpcr, %0" : : "r" (fpcr | (1 << 24)));
+#endif
+}
+
+static inline void denormal_thread_init (void *arg)
+{
+  denormals_off ();
+}
+
+/* flush one piece of filter state, for code that runs without FTZ */
+static inline double undenormal (double x)
+{
+  return (x < DENORMAL_FLOOR && x > -DENORMAL_FLOOR) ? 0.0 : x;
+}
+
+#endif
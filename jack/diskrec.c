@@ -0,0 +1,291 @@
+/*
+ * Multichannel disk recorder.
+ *
+ * The process callback interleaves its inputs straight into a
+ * jack_ringbuffer_t, the way midi_dump queues MIDI events, and wakes
+ * the main thread, which moves whole blocks from the ring to a 32 bit
+ * float WAV file.  The RT thread never touches the file.  The ring and
+ * the blocks are powers of two, so every block is one contiguous piece
+ * of the ring and goes to write(2) without a copy; the header is
+ * padded to ALIGN bytes so blocks also sit on page boundaries in the
+ * file.  Past 4GB the file becomes RF64.
+ *
+ * A cycle that does not fit in the ring is dropped whole and counted as
+ * an overrun, reported on stderr and in dspstat.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+
+#include "dspstat.h"
+#include "wavfile.h"
+
+#ifndef WIN32
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
+#define MAXCHANNELS (64)
+#define ALIGN (4096)
+
+static jack_port_t *input_port[MAXCHANNELS];
+static int nchannels = 2;
+static size_t frame_bytes;
+static jack_ringbuffer_t *rb = NULL;
+static pthread_mutex_t msg_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t data_ready = PTHREAD_COND_INITIALIZER;
+
+static int keeprunning = 1;
+static uint64_t limit = 0;      /* frames to record, 0 for no limit */
+static uint64_t captured = 0;   /* written by the RT thread only */
+static uint64_t overruns = 0;   /* frames dropped, likewise */
+
+static void interleave (float *dst, float * const *in, jack_nframes_t from, jack_nframes_t n)
+{
+  jack_nframes_t f;
+  int c;
+
+  for (f=from; f<from+n; f++) {
+    for (c=0; c<nchannels; c++) {
+      *dst++ = in[c][f];
+      }
+    }
+}
+
+int
+process (jack_nframes_t nframes, void *arg)
+{
+  const uint64_t t0 = dspstat_begin ();
+  float *in[MAXCHANNELS];
+  jack_ringbuffer_data_t vec[2];
+  jack_nframes_t n0, n = nframes;
+  size_t rem, off = 0;
+  int c;
+
+  if (limit && captured + n > limit) {
+    n = limit - captured;
+    }
+  jack_ringbuffer_get_write_vector (rb, vec);
+  if (n == 0 || !keeprunning) {
+    /* done, but keep waking the writer so it notices */
+  } else if (vec[0].len + vec[1].len < n * frame_bytes) {
+    __atomic_store_n (&overruns, overruns + n, __ATOMIC_RELAXED);
+    dspstat_dropped (n);
+  } else {
+    for (c=0; c<nchannels; c++) {
+      in[c] = (float *) jack_port_get_buffer (input_port[c], nframes);
+      }
+
+    /* whole frames up to the wrap, the frame across it, the rest */
+    n0 = vec[0].len / frame_bytes;
+    if (n0 >= n) {
+      interleave ((float *) vec[0].buf, in, 0, n);
+    } else {
+      interleave ((float *) vec[0].buf, in, 0, n0);
+      if ((rem = vec[0].len - n0 * frame_bytes) != 0) {
+        float tmp[MAXCHANNELS];
+        interleave (tmp, in, n0, 1);
+        memcpy (vec[0].buf + n0 * frame_bytes, tmp, rem);
+        memcpy (vec[1].buf, (char *) tmp + rem, frame_bytes - rem);
+        off = frame_bytes - rem;
+        n0++;
+        }
+      interleave ((float *) (vec[1].buf + off), in, n0, n - n0);
+      }
+    jack_ringbuffer_write_advance (rb, n * frame_bytes);
+    __atomic_store_n (&captured, captured + n, __ATOMIC_RELEASE);
+    }
+
+  if (pthread_mutex_trylock (&msg_thread_lock) == 0) {
+    pthread_cond_signal (&data_ready);
+    pthread_mutex_unlock (&msg_thread_lock);
+    }
+
+  dspstat_end (t0, nframes);
+  return 0;
+}
+
+/* write out whole blocks, or everything when flushing; 0 on success */
+static int drain (wavfile *wav, size_t block, int flush)
+{
+  jack_ringbuffer_data_t vec[2];
+  size_t n;
+
+  while (jack_ringbuffer_read_space (rb) >= block || (flush && jack_ringbuffer_read_space (rb))) {
+    jack_ringbuffer_get_read_vector (rb, vec);
+    n = vec[0].len < block ? vec[0].len : block;
+    if (wav_write_raw (wav, vec[0].buf, n)) {
+      return -1;
+      }
+    jack_ringbuffer_read_advance (rb, n);
+    }
+  return 0;
+}
+
+static void wearedone (int sig)
+{
+  keeprunning = 0;
+}
+
+static void usage (int status)
+{
+  printf ("usage: diskrec [ -c channels ] [ -o file ] [ -t seconds ] [ -r seconds ] [ -B kbytes ] [ -n name ] [ port ... ]\n"
+"  -c N   record N channels (1-%d, default 2)\n"
+"  -o     output file (default capture.wav)\n"
+"  -t     stop after this many seconds\n"
+"  -r     seconds of audio the ring can hold (default 2)\n"
+"  -B     write block in KiB, a power of two (default 512)\n"
+"  -n     client name (default diskrec)\n"
+"The ports given are connected to the inputs in turn.\n", MAXCHANNELS);
+  exit (status);
+}
+
+int
+main (int argc, char *argv[])
+{
+  jack_client_t *client;
+  const char *client_name = "diskrec";
+  const char *path = "capture.wav";
+  double seconds = 0, ring_seconds = 2;
+  size_t block = 512 * 1024;
+  uint64_t reported = 0, o;
+  wavfile wav;
+  unsigned long sr;
+  int opt, i, r = 0;
+
+  while ((opt = getopt (argc, argv, "c:o:t:r:B:n:h")) != -1) {
+    switch (opt) {
+      case 'c':
+        nchannels = atoi (optarg);
+        break;
+      case 'o':
+        path = optarg;
+        break;
+      case 't':
+        seconds = atof (optarg);
+        break;
+      case 'r':
+        ring_seconds = atof (optarg);
+        break;
+      case 'B':
+        block = (size_t) atoi (optarg) * 1024;
+        break;
+      case 'n':
+        client_name = optarg;
+        break;
+      case 'h':
+        usage (EXIT_SUCCESS);
+      default:
+        usage (EXIT_FAILURE);
+      }
+    }
+  if (nchannels < 1 || nchannels > MAXCHANNELS || block < ALIGN || (block & (block - 1)) || ring_seconds <= 0) {
+    usage (EXIT_FAILURE);
+    }
+  frame_bytes = nchannels * sizeof (float);
+
+  client = jack_client_open (client_name, JackNullOption, NULL);
+  if (client == NULL) {
+    fprintf (stderr, "Could not create JACK client.\n");
+    exit (EXIT_FAILURE);
+    }
+  sr = jack_get_sample_rate (client);
+  limit = seconds * sr;
+
+  /* at least a few blocks, and a power of two so blocks never wrap */
+  rb = jack_ringbuffer_create (ring_seconds * sr * frame_bytes > 4 * block ? ring_seconds * sr * frame_bytes : 4 * block);
+  if (rb == NULL) {
+    fprintf (stderr, "Could not allocate the ringbuffer.\n");
+    exit (EXIT_FAILURE);
+    }
+  jack_ringbuffer_mlock (rb);
+  memset (rb->buf, 0, rb->size);
+
+  if (wav_create_large (&wav, path, nchannels, sr, ALIGN)) {
+    fprintf (stderr, "Could not create %s.\n", path);
+    exit (EXIT_FAILURE);
+    }
+
+  dspstat_init (client, client_name);
+
+  jack_set_process_callback (client, process, 0);
+
+  if (nchannels == 1) {
+    input_port[0] = jack_port_register (client, "input", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+    }
+  else {
+    for (i=0; i<nchannels; i++) {
+      char name[32];
+      sprintf (name, "input_%d", i + 1);
+      input_port[i] = jack_port_register (client, name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+      }
+    }
+  for (i=0; i<nchannels; i++) {
+    if (input_port[i] == NULL) {
+      fprintf (stderr, "Could not register port.\n");
+      exit (EXIT_FAILURE);
+      }
+    }
+
+  printf ("recording %d channel(s) at %lu Hz to %s, %zu KiB ring, %zu KiB blocks\n",
+          nchannels, sr, path, rb->size / 1024, block / 1024);
+
+#ifndef WIN32
+  if (mlockall (MCL_CURRENT | MCL_FUTURE)) {
+    fprintf (stderr, "Warning: Can not lock memory.\n");
+    }
+#endif
+
+  if (jack_activate (client)) {
+    fprintf (stderr, "Could not activate client.\n");
+    exit (EXIT_FAILURE);
+    }
+
+  for (i=optind; i<argc; i++) {
+    if (jack_connect (client, argv[i], jack_port_name (input_port[(i - optind) % nchannels]))) {
+      fprintf (stderr, "cannot connect \"%s\"\n", argv[i]);
+      }
+    }
+
+#ifndef WIN32
+  signal (SIGHUP, wearedone);
+  signal (SIGINT, wearedone);
+#endif
+
+  /* the lock is only held while waiting, so the RT thread's trylock
+     rarely misses while a block is being written */
+  pthread_mutex_lock (&msg_thread_lock);
+  while (keeprunning && !(limit && __atomic_load_n (&captured, __ATOMIC_ACQUIRE) == limit)) {
+    pthread_cond_wait (&data_ready, &msg_thread_lock);
+    pthread_mutex_unlock (&msg_thread_lock);
+    if (drain (&wav, block, 0)) {
+      fprintf (stderr, "write to %s failed\n", path);
+      r = 1;
+      keeprunning = 0;
+      }
+    if ((o = __atomic_load_n (&overruns, __ATOMIC_RELAXED)) != reported) {
+      fprintf (stderr, "overrun: %" PRIu64 " frames dropped so far\n", o);
+      reported = o;
+      }
+    pthread_mutex_lock (&msg_thread_lock);
+    }
+  pthread_mutex_unlock (&msg_thread_lock);
+
+  jack_deactivate (client);
+  if ((!r && drain (&wav, block, 1)) || wav_close (&wav)) {
+    fprintf (stderr, "write to %s failed\n", path);
+    r = 1;
+    }
+  printf ("%" PRIu64 " frames recorded, %" PRIu64 " dropped\n", captured, overruns);
+  dspstat_close ();
+  jack_client_close (client);
+  jack_ringbuffer_free (rb);
+
+  return r;
+}
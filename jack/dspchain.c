@@ -0,0 +1,433 @@
+/*
+ * Single-process DSP graph host.
+ *
+ * Loads tools built as in-process nodes (see chain.h) and runs them in
+ * order inside one JACK process callback, e.g.
+ *
+ *   dspchain jsynthosc -p 64 : formant 0 : biquad 1000
+ *
+ * instead of three clients wired through the server.  Each node's
+ * audio outputs feed the next node's audio inputs directly: output j
+ * goes to input j % inputs, outputs landing on the same input are
+ * summed, and with fewer outputs than inputs they fan out.  Node
+ * outputs live in two sets of scratch buffers used by alternate nodes,
+ * so the working set stays at two stages however long the chain is.
+ * Only the chain's outer ports are registered with JACK, named
+ * node_port: the audio inputs of the first node, the audio outputs of
+ * the last, and every MIDI port.
+ *
+ * Each node's dspstat times its own stage; with DSPSTAT_SOCKET set a
+ * node serves its stats on path.node next to the host's.  A node can
+ * only appear once, since loading it twice shares its state.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <jack/jack.h>
+#include <jack/thread.h>
+
+#include "chain.h"
+#include "dspstat.h"
+
+#define MAXNODES (8)
+#define MAXFRAMES (8192)
+
+#define POOL_MIX (2)  /* pools 0 and 1 hold alternate nodes' outputs */
+
+typedef struct {
+  jack_port_t *outer;   /* registered with JACK, buf follows it every cycle */
+  int nsrc;             /* more than one: buf is a mix of these */
+  chain_port *src[CHAIN_MAXPORTS];
+  } wire;
+
+typedef struct {
+  const char *name;
+  int argc;
+  char **argv;
+  void *dl;
+  chain_node *node;
+  int (*main) (int argc, char *argv[]);
+  wire w[CHAIN_MAXPORTS];
+  } stage;
+
+static stage stages[MAXNODES];
+static int nstages;
+static chain_host host;
+static jack_port_t *outer_out[MAXNODES * CHAIN_MAXPORTS];
+static int nouter_out;
+static float *pool[3][CHAIN_MAXPORTS];
+
+static void usage (void)
+{
+  fprintf (stderr, "usage: dspchain [ -n name ] [ -d nodedir ] node [ args ] [ : node [ args ] ... ]\n"
+"  runs each node (nodedir/node.so, built by 'make nodes') in order in one client;\n"
+"  nodedir defaults to the directory dspchain is in\n");
+  exit (EXIT_FAILURE);
+}
+
+static float *pool_buffer (int which, int k)
+{
+  void *p;
+
+  if (pool[which][k] == NULL) {
+    if (posix_memalign (&p, 64, MAXFRAMES * sizeof (float))) {
+      fprintf (stderr, "cannot allocate scratch buffers\n");
+      exit (EXIT_FAILURE);
+      }
+    memset (p, 0, MAXFRAMES * sizeof (float));
+    pool[which][k] = p;
+    }
+  return pool[which][k];
+}
+
+static int is_audio (const chain_port *p, unsigned long dir)
+{
+  return !p->midi && (p->flags & dir);
+}
+
+static int count_audio (const chain_node *n, unsigned long dir)
+{
+  int i, c = 0;
+
+  for (i=0; i<n->nports; i++) {
+    c += is_audio (&n->port[i], dir);
+    }
+  return c;
+}
+
+static void thread_init (void *arg)
+{
+  int s;
+
+  for (s=0; s<nstages; s++) {
+    if (stages[s].node->thread_init) {
+      stages[s].node->thread_init (stages[s].node->thread_init_arg);
+      }
+    }
+}
+
+int
+process (jack_nframes_t nframes, void *arg)
+{
+  const uint64_t t0 = dspstat_begin ();
+  int s, i, j;
+  jack_nframes_t f;
+
+  if (nframes > MAXFRAMES) {
+    for (i=0; i<nouter_out; i++) {
+      memset (jack_port_get_buffer (outer_out[i], nframes), 0, nframes * sizeof (float));
+      }
+    dspstat_end (t0, nframes);
+    return 0;
+    }
+
+  for (s=0; s<nstages; s++) {
+    chain_node *n = stages[s].node;
+
+    for (i=0; i<n->nports; i++) {
+      const wire *w = &stages[s].w[i];
+      chain_port *p = &n->port[i];
+
+      if (w->outer) {
+        p->buf = jack_port_get_buffer (w->outer, nframes);
+      } else if (w->nsrc > 1) {
+        float *mix = p->buf;
+        memcpy (mix, w->src[0]->buf, nframes * sizeof (float));
+        for (j=1; j<w->nsrc; j++) {
+          const float *in = w->src[j]->buf;
+          for (f=0; f<nframes; f++) {
+            mix[f] += in[f];
+            }
+          }
+        }
+      }
+    n->process (nframes, n->process_arg);
+    }
+
+  dspstat_end (t0, nframes);
+  return 0;
+}
+
+void
+jack_shutdown (void *arg)
+{
+  exit (1);
+}
+
+static void *node_main (void *arg)
+{
+  stage *st = arg;
+
+  optind = 0;
+  st->main (st->argc, st->argv);
+  sem_post (&host.ready);
+  return NULL;
+}
+
+/* load a node and run its main until it activates */
+static void start_node (stage *st, const char *nodedir)
+{
+  char path[1024];
+  const char *sock = getenv ("DSPSTAT_SOCKET");
+  char *saved = sock ? strdup (sock) : NULL;
+  pthread_t thread;
+  int s;
+
+  for (s=0; &stages[s] != st; s++) {
+    if (!strcmp (stages[s].name, st->name)) {
+      fprintf (stderr, "%s: a node can only appear once\n", st->name);
+      exit (EXIT_FAILURE);
+      }
+    }
+
+  snprintf (path, sizeof (path), strchr (st->name, '/') ? "%s" : "%s/%s.so",
+            strchr (st->name, '/') ? st->name : nodedir, st->name);
+  if ((st->dl = dlopen (path, RTLD_NOW | RTLD_LOCAL)) == NULL
+      || (st->node = dlsym (st->dl, "chain_this")) == NULL
+      || (st->main = dlsym (st->dl, "tool_main")) == NULL) {
+    fprintf (stderr, "cannot load node %s: %s\n", path, dlerror ());
+    exit (EXIT_FAILURE);
+    }
+  if (strrchr (st->name, '/')) {
+    st->name = strrchr (st->name, '/') + 1;
+    }
+  snprintf (st->node->name, sizeof (st->node->name), "%s", st->name);
+  st->node->host = &host;
+
+  if (saved) {
+    char nodesock[256];
+    snprintf (nodesock, sizeof (nodesock), "%s.%s", saved, st->name);
+    setenv ("DSPSTAT_SOCKET", nodesock, 1);
+    }
+  if (pthread_create (&thread, NULL, node_main, st)) {
+    fprintf (stderr, "cannot start node %s\n", st->name);
+    exit (EXIT_FAILURE);
+    }
+  sem_wait (&host.ready);
+  if (saved) {
+    setenv ("DSPSTAT_SOCKET", saved, 1);
+    free (saved);
+    }
+
+  if (!st->node->active || st->node->process == NULL) {
+    fprintf (stderr, "node %s did not start\n", st->name);
+    exit (EXIT_FAILURE);
+    }
+}
+
+static jack_port_t *register_outer (jack_client_t *client, const stage *st, const chain_port *p)
+{
+  char name[160];
+  jack_port_t *port;
+
+  snprintf (name, sizeof (name), "%s_%s", st->name, p->name);
+  port = jack_port_register (client, name, p->midi ? JACK_DEFAULT_MIDI_TYPE : JACK_DEFAULT_AUDIO_TYPE,
+                             p->flags & (JackPortIsInput | JackPortIsOutput), 0);
+  if (port == NULL) {
+    fprintf (stderr, "cannot register port %s\n", name);
+    exit (EXIT_FAILURE);
+    }
+  return port;
+}
+
+/* give every port either a real JACK port or a scratch buffer */
+static void wire_stages (jack_client_t *client)
+{
+  chain_port *prev[CHAIN_MAXPORTS];
+  int nprev = 0, nmix = 0;
+  int s, i, j, k;
+
+  for (s=0; s<nstages; s++) {
+    chain_node *n = stages[s].node;
+    const int nin = count_audio (n, JackPortIsInput);
+    const int nnext = s + 1 < nstages ? count_audio (stages[s + 1].node, JackPortIsInput) : 0;
+    chain_port *out[CHAIN_MAXPORTS];
+    int nout = 0;
+
+    for (i=0, k=0; i<n->nports; i++) {
+      chain_port *p = &n->port[i];
+      wire *w = &stages[s].w[i];
+
+      if (p->midi || (is_audio (p, JackPortIsInput) && nprev == 0)
+          || (is_audio (p, JackPortIsOutput) && nnext == 0)) {
+        w->outer = register_outer (client, &stages[s], p);
+        if (is_audio (p, JackPortIsOutput)) {
+          outer_out[nouter_out++] = w->outer;
+          }
+        }
+      else if (is_audio (p, JackPortIsInput)) {
+        if (nprev < nin) {
+          p->buf = prev[k % nprev]->buf;
+        } else {
+          for (j=k; j<nprev; j+=nin) {
+            w->src[w->nsrc++] = prev[j];
+            }
+          p->buf = w->nsrc > 1 ? pool_buffer (POOL_MIX, nmix++) : w->src[0]->buf;
+          }
+        k++;
+        }
+      else if (is_audio (p, JackPortIsOutput)) {
+        p->buf = pool_buffer (s & 1, nout);
+        out[nout++] = p;
+        }
+      }
+    memcpy (prev, out, nout * sizeof (chain_port *));
+    nprev = nout;
+    }
+}
+
+static void connect_outer (jack_client_t *client, const char *name)
+{
+  const char **ports;
+  int s, i, n;
+
+  /*
+   * The first source that is not a through port plays the first node
+   * with a MIDI input.  Later MIDI inputs are control ports (formant's
+   * vowel, biquad's cutoff) and stay for the user to patch.
+   */
+  if ((ports = jack_get_ports (client, NULL, JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput)) != NULL) {
+    for (i=0; ports[i] != NULL; i++) {
+      if (!strstr (ports[i], "Through") && strncmp (ports[i], name, strlen (name))) {
+        break;
+        }
+      }
+    for (s=0; ports[i] != NULL && s<nstages; s++) {
+      for (n=0; n<stages[s].node->nports; n++) {
+        const chain_port *p = &stages[s].node->port[n];
+        if (p->midi && (p->flags & JackPortIsInput)) {
+          break;
+          }
+        }
+      if (n < stages[s].node->nports) {
+        printf ("connecting %s\n", ports[i]);
+        if (jack_connect (client, ports[i], jack_port_name (stages[s].w[n].outer))) {
+          fprintf (stderr, "cannot connect \"%s\" to \"%s\"\n", ports[i], jack_port_name (stages[s].w[n].outer));
+          }
+        break;
+        }
+      }
+    free (ports);
+    }
+
+  /* a mono chain plays on both speakers */
+  if (nouter_out == 0 || (ports = jack_get_ports (client, NULL, NULL, JackPortIsPhysical|JackPortIsInput)) == NULL) {
+    return;
+    }
+  for (i=0; ports[i] != NULL && (i < nouter_out || i < 2); i++) {
+    if (jack_connect (client, jack_port_name (outer_out[i % nouter_out]), ports[i])) {
+      fprintf (stderr, "cannot connect output ports\n");
+      }
+    }
+  free (ports);
+}
+
+int
+main (int argc, char *argv[])
+{
+  jack_client_t *client;
+  const char *name = "dspchain";
+  char *nodedir = NULL, *slash;
+  int opt, i, s;
+
+  while ((opt = getopt (argc, argv, "+n:d:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        name = optarg;
+        break;
+      case 'd':
+        nodedir = optarg;
+        break;
+      default:
+        usage ();
+      }
+    }
+  if (optind == argc) {
+    usage ();
+    }
+  if (nodedir == NULL) {
+    nodedir = strdup (argv[0]);
+    if ((slash = strrchr (nodedir, '/')) != NULL) {
+      *slash = '\0';
+    } else {
+      strcpy (nodedir, ".");
+      }
+    }
+
+  /* split the rest at ':' into one argv per node */
+  for (i=optind; i<argc; i++) {
+    if (!strcmp (argv[i], ":")) {
+      argv[i] = NULL;
+      continue;
+      }
+    if (i == optind || argv[i - 1] == NULL) {
+      if (nstages == MAXNODES) {
+        fprintf (stderr, "at most %d nodes\n", MAXNODES);
+        return 1;
+        }
+      stages[nstages].name = argv[i];
+      stages[nstages].argv = &argv[i];
+      nstages++;
+      }
+    stages[nstages - 1].argc++;
+    }
+  if (nstages == 0) {
+    usage ();
+    }
+
+  if ((client = jack_client_open (name, (jack_options_t)0, NULL)) == NULL) {
+    fprintf (stderr, "jack server not running?\n");
+    return 1;
+  }
+
+  host.client = client;
+  host.rate = jack_get_sample_rate (client);
+  host.buffer_size = jack_get_buffer_size;
+  host.frame_time = jack_frame_time;
+  host.last_frame_time = jack_last_frame_time;
+  host.transport_query = jack_transport_query;
+  host.real_time_priority = jack_client_real_time_priority;
+  host.create_thread = jack_client_create_thread;
+  sem_init (&host.ready, 0, 0);
+
+  for (s=0; s<nstages; s++) {
+    start_node (&stages[s], nodedir);
+    }
+  wire_stages (client);
+
+  jack_set_process_callback (client, process, 0);
+  jack_set_thread_init_callback (client, thread_init, 0);
+  jack_on_shutdown (client, jack_shutdown, 0);
+
+  dspstat_init (client, name);
+
+  for (s=0; s<nstages; s++) {
+    printf ("%s%s", s ? " -> " : "", stages[s].name);
+    }
+  printf (", %d outer output(s)\n", nouter_out);
+
+#ifndef WIN32
+  if (mlockall (MCL_CURRENT | MCL_FUTURE)) {
+    fprintf (stderr, "Warning: Can not lock memory.\n");
+    }
+#endif
+
+  if (jack_activate (client)) {
+    fprintf (stderr, "cannot activate client");
+    return 1;
+  }
+
+  connect_outer (client, name);
+
+  while (1) {
+    sleep (10);
+    }
+  jack_client_close (client);
+  return 0;
+}
@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <jack/jack.h>
+
+#include "dspstat.h"
+
+/* cycle load histogram in 2% steps; the last bucket is >= 100%, a miss */
+#define NBUCKETS (51)
+#define BUCKET_PCT (2)
+
+typedef struct {
+  uint64_t cycles;
+  uint64_t misses;
+  uint64_t xruns;
+  uint64_t dropped;
+  uint64_t busy_ns;
+  uint64_t budget_ns;
+  uint64_t max_ns;
+  uint64_t hist[NBUCKETS];
+  } stats;
+
+/* written by the RT thread (and the xrun callback) only, read by the reporter */
+static stats live;
+
+static const char *client_name = "";
+static double ns_per_frame;
+static int interval;
+static int sockfd = -1;
+static char sockpath[108];
+static pthread_t reporter;
+static int running;
+static int pipefd[2] = { -1, -1 };
+
+static inline void bump (uint64_t *c, uint64_t n)
+{
+  __atomic_store_n (c, *c + n, __ATOMIC_RELAXED);
+}
+
+uint64_t dspstat_begin (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void dspstat_end (uint64_t start, jack_nframes_t nframes)
+{
+  const uint64_t ns = dspstat_begin () - start;
+  const uint64_t budget = nframes * ns_per_frame;
+  unsigned b = budget ? ns * 100 / budget / BUCKET_PCT : NBUCKETS - 1;
+
+  if (b >= NBUCKETS) {
+    b = NBUCKETS - 1;
+    }
+  if (ns > budget) {
+    bump (&live.misses, 1);
+    }
+  if (ns > live.max_ns) {
+    __atomic_store_n (&live.max_ns, ns, __ATOMIC_RELAXED);
+    }
+  bump (&live.hist[b], 1);
+  bump (&live.busy_ns, ns);
+  bump (&live.budget_ns, budget);
+  bump (&live.cycles, 1);
+}
+
+void dspstat_dropped (unsigned n)
+{
+  bump (&live.dropped, n);
+}
+
+static int on_xrun (void *arg)
+{
+  __atomic_fetch_add (&live.xruns, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+static void snapshot (stats *s)
+{
+  int i;
+
+  s->cycles = __atomic_load_n (&live.cycles, __ATOMIC_RELAXED);
+  s->misses = __atomic_load_n (&live.misses, __ATOMIC_RELAXED);
+  s->xruns = __atomic_load_n (&live.xruns, __ATOMIC_RELAXED);
+  s->dropped = __atomic_load_n (&live.dropped, __ATOMIC_RELAXED);
+  s->busy_ns = __atomic_load_n (&live.busy_ns, __ATOMIC_RELAXED);
+  s->budget_ns = __atomic_load_n (&live.budget_ns, __ATOMIC_RELAXED);
+  s->max_ns = __atomic_load_n (&live.max_ns, __ATOMIC_RELAXED);
+  for (i=0; i<NBUCKETS; i++) {
+    s->hist[i] = __atomic_load_n (&live.hist[i], __ATOMIC_RELAXED);
+    }
+}
+
+/* the bucket holding the q'th quantile, as "<edge%" or ">=100%" */
+static const char *load_quantile (char *buf, const uint64_t *hist, uint64_t n, double q)
+{
+  uint64_t seen = 0;
+  int i;
+
+  for (i=0; i<NBUCKETS-1; i++) {
+    seen += hist[i];
+    if (seen > q * n) {
+      break;
+      }
+    }
+  if (i == NBUCKETS-1) {
+    return ">=100%";
+    }
+  sprintf (buf, "<%d%%", (i + 1) * BUCKET_PCT);
+  return buf;
+}
+
+/* describe the cycles between prev and cur (prev zeroed for totals) */
+static int format (char *buf, size_t len, const stats *cur, const stats *prev)
+{
+  uint64_t hist[NBUCKETS];
+  const uint64_t n = cur->cycles - prev->cycles;
+  const uint64_t budget = cur->budget_ns - prev->budget_ns;
+  char q50[16], q99[16];
+  int i;
+
+  for (i=0; i<NBUCKETS; i++) {
+    hist[i] = cur->hist[i] - prev->hist[i];
+    }
+  return snprintf (buf, len,
+                   "%s: cycles %" PRIu64 " load avg %.1f%% p50 %s p99 %s max %.1fus"
+                   " misses %" PRIu64 " xruns %" PRIu64 " dropped %" PRIu64 "\n",
+                   client_name, n,
+                   budget ? 100.0 * (cur->busy_ns - prev->busy_ns) / budget : 0.0,
+                   load_quantile (q50, hist, n, 0.5), load_quantile (q99, hist, n, 0.99),
+                   cur->max_ns / 1e3,
+                   cur->misses - prev->misses, cur->xruns - prev->xruns,
+                   cur->dropped - prev->dropped);
+}
+
+static void serve (int fd)
+{
+  static const stats zero;
+  stats now;
+  char buf[512];
+  int i, len;
+
+  snapshot (&now);
+  len = format (buf, sizeof (buf), &now, &zero);
+  if (write (fd, buf, len) < 0) {
+    return;
+    }
+  for (i=0; i<NBUCKETS; i++) {
+    len = snprintf (buf, sizeof (buf), "%s%d%%: %" PRIu64 "\n",
+                    i == NBUCKETS - 1 ? ">=" : "<", i == NBUCKETS - 1 ? 100 : (i + 1) * BUCKET_PCT, now.hist[i]);
+    if (write (fd, buf, len) < 0) {
+      return;
+      }
+    }
+}
+
+/*
+ * Report lines fall due on a fixed grid of interval seconds; the poll
+ * timeout is whatever is left until the next one, so serving a query
+ * does not push the grid back.
+ */
+static void *report_main (void *arg)
+{
+  struct pollfd pfd[2];
+  stats prev, now;
+  char buf[512];
+  const uint64_t period_ns = interval > 0 ? (uint64_t) interval * 1000000000 : 0;
+  uint64_t due = dspstat_begin () + period_ns;
+  int n = 0, fd;
+
+  memset (&prev, 0, sizeof (prev));
+  pfd[n].fd = pipefd[0];
+  pfd[n++].events = POLLIN;
+  if (sockfd >= 0) {
+    pfd[n].fd = sockfd;
+    pfd[n++].events = POLLIN;
+    }
+
+  while (__atomic_load_n (&running, __ATOMIC_ACQUIRE)) {
+    const uint64_t t = dspstat_begin ();
+    int timeout = -1;
+    int r;
+
+    if (period_ns > 0) {
+      if (t >= due) {
+        snapshot (&now);
+        format (buf, sizeof (buf), &now, &prev);
+        fputs (buf, stderr);
+        prev = now;
+        due += period_ns;
+        if (due <= t) {
+          /* stalled past a whole interval: one line, not a burst */
+          due = t + period_ns;
+          }
+        continue;
+        }
+      /* round up so the wakeup never lands just short of the deadline */
+      timeout = (due - t + 999999) / 1000000;
+      }
+    r = poll (pfd, n, timeout);
+
+    if (r > 0 && n > 1 && (pfd[1].revents & POLLIN)) {
+      if ((fd = accept (sockfd, NULL, NULL)) >= 0) {
+        serve (fd);
+        close (fd);
+        }
+      }
+    }
+  return NULL;
+}
+
+int dspstat_init (jack_client_t *client, const char *name)
+{
+  const char *env;
+  struct sockaddr_un addr;
+
+  client_name = name;
+  ns_per_frame = 1e9 / jack_get_sample_rate (client);
+  jack_set_xrun_callback (client, on_xrun, NULL);
+
+  if ((env = getenv ("DSPSTAT_INTERVAL")) != NULL) {
+    interval = atoi (env);
+    }
+  if ((env = getenv ("DSPSTAT_SOCKET")) != NULL && *env) {
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    snprintf (sockpath, sizeof (sockpath), "%s", env);
+    memcpy (addr.sun_path, sockpath, sizeof (addr.sun_path) - 1);
+    unlink (sockpath);
+    if ((sockfd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0
+        || bind (sockfd, (struct sockaddr *) &addr, sizeof (addr))
+        || listen (sockfd, 4)) {
+      fprintf (stderr, "dspstat: cannot listen on %s\n", sockpath);
+      if (sockfd >= 0) {
+        close (sockfd);
+        }
+      sockfd = -1;
+      }
+    }
+
+  if (interval <= 0 && sockfd < 0) {
+    return 0;
+    }
+  if (pipe (pipefd)) {
+    return -1;
+    }
+  running = 1;
+  if (pthread_create (&reporter, NULL, report_main, NULL)) {
+    running = 0;
+    return -1;
+    }
+  return 0;
+}
+
+void dspstat_close (void)
+{
+  static const stats zero;
+  stats now;
+  char buf[512];
+
+  if (!running) {
+    return;
+    }
+  __atomic_store_n (&running, 0, __ATOMIC_RELEASE);
+  if (write (pipefd[1], "", 1) < 0) {
+    return;
+    }
+  pthread_join (reporter, NULL);
+
+  snapshot (&now);
+  format (buf, sizeof (buf), &now, &zero);
+  fprintf (stderr, "total %s", buf);
+
+  if (sockfd >= 0) {
+    close (sockfd);
+    unlink (sockpath);
+    }
+  close (pipefd[0]);
+  close (pipefd[1]);
+}
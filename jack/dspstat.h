@@ -0,0 +1,38 @@
+/*
+ * Lightweight per-cycle DSP instrumentation shared by the jack clients.
+ *
+ * The process callback brackets its work with dspstat_begin() and
+ * dspstat_end(); that records the cycle's duration against the period's
+ * wall-clock budget into a lock-free histogram, counting deadline
+ * misses.  Dropped events are counted with dspstat_dropped() and xruns
+ * come from JACK's xrun callback.  Nothing on the RT side locks,
+ * allocates or makes syscalls beyond reading the monotonic clock.
+ *
+ * Reporting happens on a plain thread, configured from the environment
+ * so every tool gets it without new options:
+ *
+ *   DSPSTAT_INTERVAL=secs   print a stats line to stderr every secs
+ *   DSPSTAT_SOCKET=path     serve the cumulative stats as text to anyone
+ *                           connecting to the Unix socket at path
+ */
+
+#ifndef DSPSTAT_H
+#define DSPSTAT_H
+
+#include <stdint.h>
+#include <jack/jack.h>
+
+/* hook up the xrun callback and start the reporter if asked for */
+int dspstat_init (jack_client_t *client, const char *name);
+
+/* timestamp to pass to dspstat_end() */
+uint64_t dspstat_begin (void);
+
+void dspstat_end (uint64_t start, jack_nframes_t nframes);
+
+void dspstat_dropped (unsigned n);
+
+/* stop the reporter and print a final summary if reporting was on */
+void dspstat_close (void);
+
+#endif
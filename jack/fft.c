@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "fft.h"
+
+/*
+ * A real transform of n points runs as a complex one of m = n/2 points
+ * on the even samples as real and the odd ones as imaginary parts,
+ * followed by a split step that separates the two spectra.
+ */
+
+struct fft {
+  int n, m;
+  int *rev;             /* bit reversal permutation of m */
+  float *cs, *sn;       /* cos, sin of 2 pi k / m, k < m/2 */
+  float *tc, *ts;       /* cos, sin of 2 pi k / n, k <= m */
+  float *zr, *zi;       /* complex work buffers of m */
+  };
+
+fft *fft_create (int n)
+{
+  fft *f;
+  int k, bits, i;
+
+  if (n < 4 || (n & (n - 1)) || (f = calloc (1, sizeof (fft))) == NULL) {
+    return NULL;
+    }
+  f->n = n;
+  f->m = n / 2;
+  f->rev = malloc (f->m * sizeof (int));
+  f->cs = malloc (f->m / 2 * sizeof (float));
+  f->sn = malloc (f->m / 2 * sizeof (float));
+  f->tc = malloc ((f->m + 1) * sizeof (float));
+  f->ts = malloc ((f->m + 1) * sizeof (float));
+  f->zr = malloc (f->m * sizeof (float));
+  f->zi = malloc (f->m * sizeof (float));
+  if (!f->rev || !f->cs || !f->sn || !f->tc || !f->ts || !f->zr || !f->zi) {
+    fft_free (f);
+    return NULL;
+    }
+
+  for (bits=0; 1 << bits < f->m; bits++);
+  for (k=0; k<f->m; k++) {
+    int r = 0;
+    for (i=0; i<bits; i++) {
+      r |= ((k >> i) & 1) << (bits - 1 - i);
+      }
+    f->rev[k] = r;
+    }
+  for (k=0; k<f->m/2; k++) {
+    f->cs[k] = cos (2 * M_PI * k / f->m);
+    f->sn[k] = sin (2 * M_PI * k / f->m);
+    }
+  for (k=0; k<=f->m; k++) {
+    f->tc[k] = cos (2 * M_PI * k / n);
+    f->ts[k] = sin (2 * M_PI * k / n);
+    }
+  return f;
+}
+
+void fft_free (fft *f)
+{
+  if (f) {
+    free (f->rev);
+    free (f->cs);
+    free (f->sn);
+    free (f->tc);
+    free (f->ts);
+    free (f->zr);
+    free (f->zi);
+    free (f);
+    }
+}
+
+/* in place radix-2 complex transform of m points, input already in bit
+   reversed order; sign -1 forward, +1 inverse */
+static void cfft (const fft *f, float *re, float *im, float sign)
+{
+  const int m = f->m;
+  int len, i, j;
+
+  for (len=2; len<=m; len<<=1) {
+    const int half = len / 2, step = m / len;
+    for (i=0; i<m; i+=len) {
+      for (j=0; j<half; j++) {
+        const float wr = f->cs[j * step], wi = sign * f->sn[j * step];
+        const int a = i + j, b = a + half;
+        const float vr = re[b] * wr - im[b] * wi;
+        const float vi = re[b] * wi + im[b] * wr;
+        re[b] = re[a] - vr;
+        im[b] = im[a] - vi;
+        re[a] += vr;
+        im[a] += vi;
+        }
+      }
+    }
+}
+
+void fft_forward (fft *f, const float *in, float *re, float *im)
+{
+  const int m = f->m;
+  float *zr = f->zr, *zi = f->zi;
+  int k;
+
+  for (k=0; k<m; k++) {
+    zr[f->rev[k]] = in[2 * k];
+    zi[f->rev[k]] = in[2 * k + 1];
+    }
+  cfft (f, zr, zi, -1);
+
+  /* X[k] = E[k] + W^k O[k], with E = (Z[k] + conj Z[m-k]) / 2 the even
+     samples' spectrum and O = (Z[k] - conj Z[m-k]) / 2i the odd ones' */
+  re[0] = zr[0] + zi[0];
+  im[0] = 0;
+  re[m] = zr[0] - zi[0];
+  im[m] = 0;
+  for (k=1; k<m; k++) {
+    const float er = 0.5f * (zr[k] + zr[m - k]), ei = 0.5f * (zi[k] - zi[m - k]);
+    const float or = 0.5f * (zi[k] + zi[m - k]), oi = -0.5f * (zr[k] - zr[m - k]);
+    re[k] = er + f->tc[k] * or + f->ts[k] * oi;
+    im[k] = ei + f->tc[k] * oi - f->ts[k] * or;
+    }
+}
+
+void fft_inverse (fft *f, const float *re, const float *im, float *out)
+{
+  const int m = f->m;
+  float *zr = f->zr, *zi = f->zi;
+  int k;
+
+  /* undo the split: E = X[k] + conj X[m-k], O = (X[k] - conj X[m-k]) W^-k,
+     each twice its forward value, and Z = E + i O */
+  for (k=0; k<m; k++) {
+    const float er = re[k] + re[m - k], ei = im[k] - im[m - k];
+    const float dr = re[k] - re[m - k], di = im[k] + im[m - k];
+    const float or = dr * f->tc[k] - di * f->ts[k];
+    const float oi = di * f->tc[k] + dr * f->ts[k];
+    zr[f->rev[k]] = er - oi;
+    zi[f->rev[k]] = ei + or;
+    }
+  cfft (f, zr, zi, 1);
+
+  for (k=0; k<m; k++) {
+    out[2 * k] = zr[k];
+    out[2 * k + 1] = zi[k];
+    }
+}
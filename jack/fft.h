@@ -0,0 +1,25 @@
+/*
+ * Small real FFT for the jack tools, so convolution needs no library
+ * beyond libm.  Sizes are powers of two; a transform of n real samples
+ * gives n/2+1 complex bins as split real and imaginary arrays.  All
+ * tables are built by fft_create(), so the transforms themselves are
+ * safe on the RT thread.
+ */
+
+#ifndef FFT_H
+#define FFT_H
+
+typedef struct fft fft;
+
+/* plan real transforms of n points; NULL if n is not a power of two >= 4 */
+fft *fft_create (int n);
+void fft_free (fft *f);
+
+/* n real samples to bins 0..n/2 */
+void fft_forward (fft *f, const float *in, float *re, float *im);
+
+/* bins 0..n/2 back to n real samples; unscaled, so a round trip
+   multiplies by n */
+void fft_inverse (fft *f, const float *re, const float *im, float *out);
+
+#endif
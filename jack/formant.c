@@ -9,13 +9,22 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#include <math.h>
+#include <complex.h>
 
 #include <jack/jack.h>
+#include <jack/midiport.h>
+
+#include "dspstat.h"
+#include "denormal.h"
 
 jack_port_t *input_port;
 jack_port_t *output_port;
+jack_port_t *midi_port;
 
 static int vowel;
+static int legacy = 0;
 
 /*
 Public source code by alex@smartelectronix.com
@@ -76,6 +85,270 @@ memory[0]=(double) res;
 return res;
 }
 
+/*
+ * The same filters as a parallel bank of float resonators.  Each vowel
+ * is an all-pole filter g / (1 - c1 z^-1 - ... - c10 z^-10); at startup
+ * its ten poles are found and paired into five conjugate second-order
+ * sections, and the partial fraction expansion gives every section a
+ * first-order numerator.  The sections run side by side in the lanes
+ * of two 4-wide vectors, each with just two state words, and their
+ * outputs are summed.  Unlike the direct form this is well conditioned
+ * in float.  (One 8-wide AVX vector measures slower: the horizontal sum
+ * on the critical path costs more than the second register saves.)
+ *
+ * For morphing, section k is always the k'th formant by frequency, and
+ * a table of MORPHSTEPS sets of sections per pair of neighbouring
+ * vowels is built by sliding each pole from one vowel to the next in
+ * log radius and angle.  The RT thread only reads the table: a block's
+ * sections are a linear mix of two neighbouring entries, and within the
+ * block the coefficients ramp to it.  A second-order section is stable
+ * on a convex region of (b1, b2), so these mixes of stable sections are
+ * stable too.
+ */
+
+#define ORDER 10
+#define NSECT (ORDER / 2)
+#define LANES 4
+#define NVEC ((NSECT + LANES - 1) / LANES)
+
+#define NVOWELS 5
+#define MORPHSTEPS 64
+#define NMORPH ((NVOWELS - 1) * MORPHSTEPS + 1)
+
+#define BLOCKLEN 32       /* frames per morph position */
+#define SMOOTH_MS 30.0    /* time constant of the morph glide */
+#define CC_MORPH 1        /* mod wheel: 0 = A ... 127 = U */
+
+typedef float vf __attribute__ ((vector_size (LANES * sizeof(float))));
+typedef int vi __attribute__ ((vector_size (LANES * sizeof(float))));
+
+/* section k in lane k: y = a0 x + a1 x[-1] - b1 y[-1] - b2 y[-2] */
+typedef struct {
+  vf a0[NVEC], a1[NVEC], b1[NVEC], b2[NVEC];
+  } rescoefs;
+
+typedef struct {
+  rescoefs c;
+  vf s1[NVEC], s2[NVEC];
+  } resonator;
+
+static rescoefs morph[NMORPH];
+static resonator bank;
+
+/* morph position in vowels, 0 (A) to NVOWELS-1 (U): the target from the
+   command line and MIDI, and the smoothed value being played */
+static double morph_to, morph_at;
+static double smooth;
+
+/* roots of z^10 - c1 z^9 - ... - c10 by Durand-Kerner */
+static void find_poles (const double *c, double complex *p)
+{
+  double complex z0 = 0.4 + 0.9 * I;
+  int i, j, k, iter;
+
+  for (i=0; i<ORDER; i++) {
+    p[i] = cpow (z0, i);
+    }
+  for (iter=0; iter<1000; iter++) {
+    double moved = 0;
+    for (i=0; i<ORDER; i++) {
+      double complex num = 1, den = 1;
+      for (k=1; k<=ORDER; k++) {
+        num = num * p[i] - c[k];
+        }
+      for (j=0; j<ORDER; j++) {
+        if (j != i) {
+          den *= p[i] - p[j];
+          }
+        }
+      num /= den;
+      p[i] -= num;
+      moved = fmax (moved, cabs (num));
+      }
+    if (moved < 1e-15) {
+      break;
+      }
+    }
+}
+
+/* the upper half plane poles of a vowel, by ascending frequency;
+   returns nonzero if they are not all complex */
+static int vowel_poles (const double *c, double complex *up)
+{
+  double complex p[ORDER], t;
+  int i, j, n = 0;
+
+  find_poles (c, p);
+  for (i=0; i<ORDER; i++) {
+    if (cimag (p[i]) > 1e-12 && n < NSECT) {
+      up[n++] = p[i];
+      }
+    }
+  for (i=0; i<n; i++) {
+    for (j=i+1; j<n; j++) {
+      if (carg (up[j]) < carg (up[i])) {
+        t = up[i]; up[i] = up[j]; up[j] = t;
+        }
+      }
+    }
+  return n != NSECT;
+}
+
+/* sections for g / prod (1 - p z^-1) (1 - conj(p) z^-1) */
+static void resonator_coefs (rescoefs *r, double g, const double complex *up)
+{
+  int i, j;
+
+  memset (r, 0, sizeof (*r));
+  for (i=0; i<NSECT; i++) {
+    /* residue at up[i]; its conjugate's is the conjugate */
+    double complex d = 1 - conj (up[i]) / up[i];
+    for (j=0; j<NSECT; j++) {
+      if (j != i) {
+        d *= (1 - up[j] / up[i]) * (1 - conj (up[j]) / up[i]);
+        }
+      }
+    const double complex res = g / d;
+
+    /* r/(1 - p z^-1) + conj(r)/(1 - conj(p) z^-1) over a common denominator */
+    r->a0[i / LANES][i % LANES] = 2 * creal (res);
+    r->a1[i / LANES][i % LANES] = -2 * creal (res * conj (up[i]));
+    r->b1[i / LANES][i % LANES] = -2 * creal (up[i]);
+    r->b2[i / LANES][i % LANES] = creal (up[i] * conj (up[i]));
+    }
+}
+
+static int morph_init (void)
+{
+  double complex up[NVOWELS][NSECT], p[NSECT];
+  int v, s, k;
+
+  for (v=0; v<NVOWELS; v++) {
+    if (vowel_poles (coeff[v], up[v])) {
+      fprintf (stderr, "vowel %d does not factor into %d resonators\n", v, NSECT);
+      return -1;
+      }
+    }
+  for (v=0; v<NVOWELS-1; v++) {
+    for (s=0; s<=MORPHSTEPS; s++) {
+      const double t = (double) s / MORPHSTEPS;
+      for (k=0; k<NSECT; k++) {
+        const double r = exp ((1 - t) * log (cabs (up[v][k])) + t * log (cabs (up[v+1][k])));
+        const double a = (1 - t) * carg (up[v][k]) + t * carg (up[v+1][k]);
+        p[k] = r * cexp (a * I);
+        }
+      resonator_coefs (&morph[v * MORPHSTEPS + s],
+                       exp ((1 - t) * log (coeff[v][0]) + t * log (coeff[v+1][0])), p);
+      }
+    }
+  return 0;
+}
+
+/* the sections for morph position m, mixed from the two nearest entries */
+static void morph_lookup (rescoefs *r, double m)
+{
+  const double x = m * MORPHSTEPS;
+  const int i = x >= NMORPH - 1 ? NMORPH - 2 : (int) x;
+  const float t = x - i;
+  int j;
+
+  for (j=0; j<NVEC; j++) {
+    r->a0[j] = morph[i].a0[j] + t * (morph[i+1].a0[j] - morph[i].a0[j]);
+    r->a1[j] = morph[i].a1[j] + t * (morph[i+1].a1[j] - morph[i].a1[j]);
+    r->b1[j] = morph[i].b1[j] + t * (morph[i+1].b1[j] - morph[i].b1[j]);
+    r->b2[j] = morph[i].b2[j] + t * (morph[i+1].b2[j] - morph[i].b2[j]);
+    }
+}
+
+static inline void flush (vf *s)
+{
+  const vf f = (vf) {0} + DENORMAL_FLOOR;
+
+  *s = (vf) ((vi) *s & ((*s > f) | (*s < -f)));
+}
+
+static inline float hsum (vf v)
+{
+  float s = 0;
+  int k;
+
+  for (k=0; k<LANES; k++) {
+    s += v[k];
+    }
+  return s;
+}
+
+static void resonator_run (resonator *r, const float *in, float *out, int n)
+{
+  int i, j;
+
+  for (i=0; i<n; i++) {
+    const vf x = (vf) {0} + in[i];
+    vf sum = {0};
+
+    for (j=0; j<NVEC; j++) {
+      const vf y = r->c.a0[j] * x + r->s1[j];
+      r->s1[j] = r->c.a1[j] * x - r->c.b1[j] * y + r->s2[j];
+      r->s2[j] = -r->c.b2[j] * y;
+      sum += y;
+      }
+    out[i] = hsum (sum);
+    }
+}
+
+/* the same while the sections ramp linearly to *to */
+static void resonator_ramp (resonator *r, const rescoefs *to, const float *in, float *out, int n)
+{
+  const float rn = 1.0f / n;
+  rescoefs d;
+  int i, j;
+
+  for (j=0; j<NVEC; j++) {
+    d.a0[j] = (to->a0[j] - r->c.a0[j]) * rn;
+    d.a1[j] = (to->a1[j] - r->c.a1[j]) * rn;
+    d.b1[j] = (to->b1[j] - r->c.b1[j]) * rn;
+    d.b2[j] = (to->b2[j] - r->c.b2[j]) * rn;
+    }
+  for (i=0; i<n; i++) {
+    const vf x = (vf) {0} + in[i];
+    vf sum = {0};
+
+    for (j=0; j<NVEC; j++) {
+      r->c.a0[j] += d.a0[j]; r->c.a1[j] += d.a1[j]; r->c.b1[j] += d.b1[j]; r->c.b2[j] += d.b2[j];
+      const vf y = r->c.a0[j] * x + r->s1[j];
+      r->s1[j] = r->c.a1[j] * x - r->c.b1[j] * y + r->s2[j];
+      r->s2[j] = -r->c.b2[j] * y;
+      sum += y;
+      }
+    out[i] = hsum (sum);
+    }
+  r->c = *to;
+}
+
+static void handlemidi (const jack_midi_data_t *b, size_t size)
+{
+  if (size == 3 && (b[0] & 0xf0) == 0xb0 && b[1] == CC_MORPH) {
+    morph_to = (NVOWELS - 1) * b[2] / 127.0;
+    }
+  else if (size == 2 && (b[0] & 0xf0) == 0xc0 && b[1] < NVOWELS) {
+    /* program change glides to that vowel */
+    morph_to = b[1];
+    }
+}
+
+/* glide the morph position one block towards its target; returns
+   nonzero when the sections move */
+static int smooth_morph (void)
+{
+  const double d = morph_to - morph_at;
+
+  if (d == 0) {
+    return 0;
+    }
+  morph_at = fabs (d) < 1e-4 ? morph_to : morph_at + smooth * d;
+  return 1;
+}
+
 
 
 /**
@@ -85,16 +358,54 @@ return res;
 int
 process (jack_nframes_t nframes, void *arg)
 {
+  const uint64_t t0 = dspstat_begin ();
   int i;
 
   jack_default_audio_sample_t *out = (jack_default_audio_sample_t *) jack_port_get_buffer (output_port, nframes);
   jack_default_audio_sample_t *in = (jack_default_audio_sample_t *) jack_port_get_buffer (input_port, nframes);
 
-  for(i=0; i<nframes; i++) {
-    out[i] = formant_filter(in[i],vowel);
+  if (legacy) {
+    for(i=0; i<nframes; i++) {
+      out[i] = formant_filter(in[i],vowel);
+      }
+
+    /* once the input stops the state decays towards zero forever */
+    for(i=0; i<10; i++) {
+      memory[i] = undenormal(memory[i]);
+      }
     }
+  else {
+    void *midibuf = jack_port_get_buffer (midi_port, nframes);
+    const uint32_t nev = jack_midi_get_event_count (midibuf);
+    jack_midi_event_t event;
+    uint32_t e = 0;
+    int done, n, j;
+
+    for (done=0; done<nframes; done+=n) {
+      n = nframes - done < BLOCKLEN ? nframes - done : BLOCKLEN;
+
+      /* controller changes take effect at the block they fall in */
+      while (e < nev && jack_midi_event_get (&event, midibuf, e) == 0 && event.time < done + n) {
+        handlemidi (event.buffer, event.size);
+        e++;
+        }
+      if (smooth_morph ()) {
+        rescoefs to;
+        morph_lookup (&to, morph_at);
+        resonator_ramp (&bank, &to, in + done, out + done, n);
+        }
+      else {
+        resonator_run (&bank, in + done, out + done, n);
+        }
+      }
 
-        
+    for (j=0; j<NVEC; j++) {
+      flush (&bank.s1[j]);
+      flush (&bank.s2[j]);
+      }
+    }
+
+  dspstat_end (t0, nframes);
   return 0;      
 }
 
@@ -110,6 +421,14 @@ jack_shutdown (void *arg)
         exit (1);
 }
 
+static volatile sig_atomic_t keeprunning = 1;
+
+static void
+wearedone (int sig)
+{
+        keeprunning = 0;
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -117,18 +436,32 @@ main (int argc, char *argv[])
         const char **ports;
         int i;
 
+        if (argc == 3 && strcmp (argv[1], "-l") == 0) {
+          /* the original 10th order direct form, in double */
+          legacy = 1;
+          argv++;
+          argc--;
+          }
+
         if (argc != 2) {
-          printf("which vowel?\n");
+          printf("which vowel? (0-4 = A E I O U, fractions in between; -l for the legacy direct form filter)\n");
+          printf("CC%d morphs from A to U, program changes 0-4 glide to a vowel.\n", CC_MORPH);
           exit(0);
           }
 
         vowel = atoi(argv[1]);
+        morph_to = morph_at = atof(argv[1]);
 
-        if (vowel < 0 || vowel > 4) {
+        if (morph_at < 0 || morph_at > NVOWELS - 1) {
           printf("invalid vowel\n");
           exit(1);
           }
 
+        if (morph_init ()) {
+          exit(1);
+          }
+        morph_lookup (&bank.c, morph_at);
+
         /* try to become a client of the JACK server */
 
         if ((client = jack_client_open("formant", (jack_options_t)0, NULL)) == NULL) {
@@ -141,6 +474,7 @@ main (int argc, char *argv[])
         */
 
         jack_set_process_callback (client, process, 0);
+        jack_set_thread_init_callback (client, denormal_thread_init, 0);
 
         /* tell the JACK server to call `jack_shutdown()' if
            it ever shuts down, either entirely, or if it
@@ -149,14 +483,20 @@ main (int argc, char *argv[])
 
         jack_on_shutdown (client, jack_shutdown, 0);
 
+        dspstat_init (client, "formant");
+        atexit (dspstat_close);
+
         /* display the current sample rate. 
          */
 
         printf ("engine sample rate: %d\n", // " PRIu"\n",
                 jack_get_sample_rate (client));
 
-        /* create two ports */
+        smooth = 1 - exp (-BLOCKLEN / (SMOOTH_MS * 0.001 * jack_get_sample_rate (client)));
 
+        /* create the ports */
+
+        midi_port = jack_port_register (client, "control", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
         input_port = jack_port_register (client, "input", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
         output_port = jack_port_register (client, "output", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
 
@@ -167,6 +507,10 @@ main (int argc, char *argv[])
                 return 1;
         }
 
+        signal (SIGHUP, wearedone);
+        signal (SIGINT, wearedone);
+        signal (SIGTERM, wearedone);
+
         /* connect the ports. Note: you can't do this before
            the client is activated, because we can't allow
            connections to be made to clients that aren't
@@ -204,7 +548,7 @@ main (int argc, char *argv[])
 
         /* Since this is just a toy, run for a few seconds, then finish */
 
-        while(1){
+        while (keeprunning) {
           sleep (10);
           }
         jack_client_close (client);
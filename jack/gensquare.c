@@ -1,40 +1,376 @@
+/*
+ * Test signal generator.
+ *
+ * Square, sine, exponential sweep, white or pink noise, an impulse
+ * train or a maximum length sequence on one output.  Each wave is a
+ * single recursive generator (phase accumulator, rotating phasor,
+ * LCG and filter, LFSR) or a table built at startup and played
+ * straight through, so a frame costs a few operations whatever the
+ * wave.
+ *
+ * With -L it measures the round trip from its output back to its
+ * input instead.  The output plays an MLS; the process callback queues
+ * the input in a jack_ringbuffer_t, tagged with where in the sequence
+ * each cycle started, and the main thread correlates every whole
+ * period of it against the sequence.  The correlation peak is the
+ * latency, interpolated to a fraction of a frame; one measurement per
+ * period, with the spread over them as the jitter.  A latency is only
+ * known modulo the MLS length, so -m must make that longer than the
+ * round trip.
+ */
+
 #include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <inttypes.h>
 #include <jack/jack.h>
+#include <jack/ringbuffer.h>
+
+#include "dspstat.h"
+#include "fft.h"
+
+#ifndef WIN32
+#include <signal.h>
+#include <pthread.h>
+#endif
+
+enum { SQUARE, SINE, SWEEP, WHITE, PINK, IMPULSE, MLS };
+
+static const char *wave_name[] = { "square", "sine", "sweep", "white", "pink", "impulse", "mls", NULL };
+
+/* Galois feedback for a maximal LFSR of each order */
+static const uint32_t mls_taps[25] = {
+  0, 0, 0x3, 0x6, 0xc, 0x14, 0x30, 0x60, 0xb8, 0x110, 0x240, 0x500, 0x829,
+  0x100d, 0x2015, 0x6000, 0xd008, 0x12000, 0x20400, 0x40023, 0x90000,
+  0x140000, 0x300000, 0x420000, 0xe10000 };
+
+#define FADE (0.01)   /* seconds at each end of a sweep */
+
+jack_port_t *output_port, *input_port;
+
+static int wave = SQUARE;
+static float amp = 0.2;
+
+static uint32_t phase, phase_inc;           /* square */
+static double ph_re = 1, ph_im, rot_re, rot_im;   /* sine: a unit phasor */
+static uint32_t seed = 1;                   /* noise */
+static float pink[7];
+static double imp_pos, imp_period;          /* impulse */
+static uint32_t lfsr = 1, lfsr_taps;        /* mls */
+
+/* sweep, and the mls when measuring: played round and round */
+static float *table;
+static uint32_t table_len, table_pos;
+
+/* loopback: one header and its frames per cycle */
+typedef struct {
+  uint32_t pos;       /* table_pos at the first frame */
+  uint32_t nframes;
+  } capture_hdr;
+
+static jack_ringbuffer_t *rb = NULL;
+static pthread_mutex_t msg_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t data_ready = PTHREAD_COND_INITIALIZER;
+static int keeprunning = 1;
+static uint64_t overruns = 0;     /* cycles dropped, written by the RT thread only */
+
+static inline float white_noise (void)
+{
+  seed = seed * 1664525 + 1013904223;
+  return ((int32_t) seed >> 8) * (1.0f / (1 << 23));
+}
 
-#define CYCLEN (8192)
-#define POLYPHONES (8)
+static void render (float *out, jack_nframes_t nframes)
+{
+  jack_nframes_t i, n;
+  float w;
+  double t, g;
 
-jack_port_t *output_port;
+  if (table) {
+    for (i=0; i<nframes; i+=n) {
+      n = table_len - table_pos < nframes - i ? table_len - table_pos : nframes - i;
+      memcpy (out + i, table + table_pos, n * sizeof (float));
+      table_pos = table_pos + n == table_len ? 0 : table_pos + n;
+      }
+    return;
+    }
 
-static jack_default_audio_sample_t cycle[CYCLEN];
+  switch (wave) {
+    case SQUARE:
+      for (i=0; i<nframes; i++) {
+        out[i] = (int32_t) phase < 0 ? -amp : amp;
+        phase += phase_inc;
+        }
+      break;
+    case SINE:
+      for (i=0; i<nframes; i++) {
+        out[i] = amp * ph_im;
+        t = ph_re * rot_re - ph_im * rot_im;
+        ph_im = ph_re * rot_im + ph_im * rot_re;
+        ph_re = t;
+        }
+      /* pull the phasor back onto the unit circle */
+      g = 1.5 - 0.5 * (ph_re * ph_re + ph_im * ph_im);
+      ph_re *= g;
+      ph_im *= g;
+      break;
+    case WHITE:
+      for (i=0; i<nframes; i++) {
+        out[i] = amp * white_noise ();
+        }
+      break;
+    case PINK:
+      /* Paul Kellet's refined filter, within 0.05dB of -3dB/octave */
+      for (i=0; i<nframes; i++) {
+        w = white_noise ();
+        pink[0] = 0.99886f * pink[0] + w * 0.0555179f;
+        pink[1] = 0.99332f * pink[1] + w * 0.0750759f;
+        pink[2] = 0.96900f * pink[2] + w * 0.1538520f;
+        pink[3] = 0.86650f * pink[3] + w * 0.3104856f;
+        pink[4] = 0.55000f * pink[4] + w * 0.5329522f;
+        pink[5] = -0.7616f * pink[5] - w * 0.0168980f;
+        out[i] = amp * 0.11f * (pink[0] + pink[1] + pink[2] + pink[3] + pink[4] + pink[5] + pink[6] + w * 0.5362f);
+        pink[6] = w * 0.115926f;
+        }
+      break;
+    case IMPULSE:
+      for (i=0; i<nframes; i++) {
+        out[i] = 0;
+        if (imp_pos < 1) {
+          out[i] = amp;
+          imp_pos += imp_period;
+          }
+        imp_pos -= 1;
+        }
+      break;
+    case MLS:
+      for (i=0; i<nframes; i++) {
+        out[i] = lfsr & 1 ? amp : -amp;
+        lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & lfsr_taps);
+        }
+      break;
+    }
+}
 
-static double fskiplen[POLYPHONES], fpos[POLYPHONES];
+/* copy into the write vector at off, across its wrap */
+static size_t put (const jack_ringbuffer_data_t *vec, size_t off, const void *src, size_t len)
+{
+  size_t n = off < vec[0].len ? vec[0].len - off : 0;
+
+  n = n < len ? n : len;
+  if (n) {
+    memcpy (vec[0].buf + off, src, n);
+    }
+  if (len > n) {
+    memcpy (vec[1].buf + off + n - vec[0].len, (const char *) src + n, len - n);
+    }
+  return off + len;
+}
 
 int process (jack_nframes_t nframes, void *arg)
 {
-  unsigned long i, j, pos, poly;
+  const uint64_t t0 = dspstat_begin ();
+  const uint32_t pos = table_pos;
+  jack_ringbuffer_data_t vec[2];
+  capture_hdr h;
 
   jack_default_audio_sample_t *out = (jack_default_audio_sample_t *) jack_port_get_buffer (output_port, nframes);
 
-  for (i=0; i<nframes; i++) {
-    out[i] = 0;
-    poly = 0;
-    for (j=0; j<POLYPHONES; j++) {
-      if (fskiplen[j] > 0.0001) {
-        fpos[j] += fskiplen[j];
-        pos = fpos[j];
-        pos %= CYCLEN;
-        out[i] += cycle[pos];
-        poly++;
+  render (out, nframes);
+
+  if (input_port) {
+    h.pos = pos;
+    h.nframes = nframes;
+    jack_ringbuffer_get_write_vector (rb, vec);
+    if (vec[0].len + vec[1].len < sizeof (h) + nframes * sizeof (float)) {
+      __atomic_store_n (&overruns, overruns + 1, __ATOMIC_RELAXED);
+      dspstat_dropped (nframes);
+    } else {
+      /* header and frames go out in one advance, so the reader never
+         sees one without the other */
+      put (vec, put (vec, 0, &h, sizeof (h)), jack_port_get_buffer (input_port, nframes), nframes * sizeof (float));
+      jack_ringbuffer_write_advance (rb, sizeof (h) + nframes * sizeof (float));
+      }
+    if (pthread_mutex_trylock (&msg_thread_lock) == 0) {
+      pthread_cond_signal (&data_ready);
+      pthread_mutex_unlock (&msg_thread_lock);
+      }
+    }
+
+  dspstat_end (t0, nframes);
+  return 0;
+}
+
+/* ---- loopback measurement, on the main thread ---- */
+
+static fft *xfft;
+static int xlen;                    /* transform size, at least twice the mls */
+static float *mls_re, *mls_im;      /* spectrum of two periods of the mls */
+static float *xbuf, *xre, *xim;
+static float *captured;             /* the last period of input, by sequence position */
+static uint64_t have, next_measure; /* contiguous frames captured, and when to measure */
+static uint32_t expect_pos;
+
+static unsigned long measured;
+static double lat_min, lat_max, lat_sum, lat_sumsq;
+
+static int setup_correlation (void)
+{
+  uint32_t k;
+
+  for (xlen = 4; xlen < 2 * (int) table_len; xlen *= 2);
+  xfft = fft_create (xlen);
+  xbuf = calloc (xlen, sizeof (float));
+  mls_re = malloc ((xlen / 2 + 1) * sizeof (float));
+  mls_im = malloc ((xlen / 2 + 1) * sizeof (float));
+  xre = malloc ((xlen / 2 + 1) * sizeof (float));
+  xim = malloc ((xlen / 2 + 1) * sizeof (float));
+  captured = calloc (table_len, sizeof (float));
+  if (!xfft || !xbuf || !mls_re || !mls_im || !xre || !xim || !captured) {
+    return -1;
+    }
+  for (k=0; k<2*table_len; k++) {
+    xbuf[k] = table[k % table_len];
+    }
+  fft_forward (xfft, xbuf, mls_re, mls_im);
+  /* the first period heard may still start with silence */
+  next_measure = 2 * table_len;
+  return 0;
+}
+
+/* correlation at a lag, taken round the period */
+static inline float lag_value (long lag)
+{
+  lag %= (long) table_len;
+  return xbuf[table_len - (lag < 0 ? lag + table_len : lag)];
+}
+
+static void measure (unsigned long sr, jack_nframes_t period)
+{
+  const uint32_t p = table_len;
+  double peak = 0, ss = 0, a, b, c, lat, d;
+  uint32_t k, s, best = 1;
+
+  memset (xbuf, 0, xlen * sizeof (float));
+  memcpy (xbuf, captured, p * sizeof (float));
+  fft_forward (xfft, xbuf, xre, xim);
+  for (k=0; k<=(uint32_t)xlen/2; k++) {
+    const float yr = xre[k], yi = xim[k];
+    xre[k] = yr * mls_re[k] + yi * mls_im[k];
+    xim[k] = yr * mls_im[k] - yi * mls_re[k];
+    }
+  fft_inverse (xfft, xre, xim, xbuf);
+
+  /* xbuf[s] is the circular correlation at lag p - s */
+  for (s=1; s<=p; s++) {
+    ss += (double) xbuf[s] * xbuf[s];
+    if (fabs (xbuf[s]) > peak) {
+      peak = fabs (xbuf[s]);
+      best = s;
+      }
+    }
+  /* a clean loop puts nearly all of it in the peak; noise spreads it */
+  if (peak * peak * p < 64 * ss) {
+    printf ("no loopback signal (peak %.1f dB over the rest)\n", 10 * log10 (peak * peak * (p - 1) / (ss - peak * peak + 1e-30)));
+    fflush (stdout);
+    return;
+    }
+
+  k = p - best;
+  a = fabs (lag_value ((long) k - 1));
+  b = fabs (lag_value (k));
+  c = fabs (lag_value ((long) k + 1));
+  d = a - 2 * b + c < 0 ? 0.5 * (a - c) / (a - 2 * b + c) : 0;
+  lat = k + d;
+
+  printf ("latency %10.2f frames %10.1f us %7.2f periods%s\n", lat, lat * 1e6 / sr,
+          lat / period, xbuf[best] < 0 ? "  (inverted)" : "");
+  fflush (stdout);
+
+  if (measured == 0 || lat < lat_min) {
+    lat_min = lat;
+    }
+  if (measured == 0 || lat > lat_max) {
+    lat_max = lat;
+    }
+  lat_sum += lat;
+  lat_sumsq += lat * lat;
+  measured++;
+}
+
+/* take everything queued, measuring at each whole period */
+static void drain (unsigned long sr, jack_nframes_t period)
+{
+  capture_hdr h;
+  float buf[1024];
+  uint32_t i, n, pos;
+
+  /* only whole cycles: the header is left in the ring until its
+     frames are all there */
+  while (jack_ringbuffer_peek (rb, (char *) &h, sizeof (h)) == sizeof (h)
+         && jack_ringbuffer_read_space (rb) >= sizeof (h) + h.nframes * sizeof (float)) {
+    jack_ringbuffer_read_advance (rb, sizeof (h));
+    if (h.pos != expect_pos && have) {
+      /* a cycle went missing: start the period again */
+      have = 0;
+      next_measure = table_len;
+      }
+    pos = h.pos;
+    while (h.nframes) {
+      n = h.nframes < 1024 ? h.nframes : 1024;
+      if (jack_ringbuffer_read (rb, (char *) buf, n * sizeof (float)) != n * sizeof (float)) {
+        return;
         }
+      for (i=0; i<n; i++) {
+        captured[pos] = buf[i];
+        pos = pos + 1 == table_len ? 0 : pos + 1;
+        if (++have == next_measure) {
+          measure (sr, period);
+          next_measure += table_len;
+          }
+        }
+      h.nframes -= n;
       }
-    out[i] /= poly;
+    expect_pos = pos;
+    }
+}
+
+/* ---- setup ---- */
+
+static void build_sweep (double f1, double f2, double seconds, unsigned long sr)
+{
+  const double k = log (f2 / f1);
+  const uint32_t fade = FADE * sr < seconds * sr / 4 ? FADE * sr : seconds * sr / 4;
+  double ph, g;
+  uint32_t i;
+
+  table_len = seconds * sr;
+  table = malloc (table_len * sizeof (float));
+  for (i=0; i<table_len; i++) {
+    ph = f1 * seconds / k * (exp (k * i / table_len) - 1);
+    g = 1;
+    if (i < fade) {
+      g = 0.5 - 0.5 * cos (M_PI * i / fade);
+    } else if (table_len - i < fade) {
+      g = 0.5 - 0.5 * cos (M_PI * (table_len - i) / fade);
+      }
+    table[i] = amp * g * sin (2 * M_PI * (ph - floor (ph)));
+    }
+}
+
+static void build_mls (int order)
+{
+  uint32_t i, r = 1;
+
+  table_len = (1u << order) - 1;
+  table = malloc (table_len * sizeof (float));
+  for (i=0; i<table_len; i++) {
+    table[i] = r & 1 ? amp : -amp;
+    r = (r >> 1) ^ (-(r & 1) & mls_taps[order]);
     }
-  return 0;      
 }
 
 void jack_shutdown (void *arg)
@@ -42,71 +378,231 @@ void jack_shutdown (void *arg)
   exit (1);
 }
 
+static void wearedone (int sig)
+{
+  keeprunning = 0;
+}
+
+static void usage (int status)
+{
+  printf ("usage: gensquare [ -w wave ] [ -a amplitude ] [ -e hz ] [ -t seconds ] [ -m order ] [ -o port ] [ -n name ] [ frequency ]\n"
+"       gensquare -L [ -c count ] [ -m order ] [ -a amplitude ] [ -i port ] [ -o port ] [ -n name ]\n"
+"  -w     square (default), sine, sweep, white, pink, impulse or mls\n"
+"  -a     peak amplitude (default 0.2)\n"
+"  -e     where a sweep ends (default 20000 Hz, or below Nyquist)\n"
+"  -t     length of a sweep in seconds (default 5)\n"
+"  -m     mls order, 2-24, for a sequence of 2^order - 1 frames (default 15)\n"
+"  -o     playback port (default the first physical one)\n"
+"  -n     client name (default gensquare)\n"
+"  -L     measure the round trip from output to input with an mls\n"
+"  -c     stop after this many measurements and print the spread\n"
+"  -i     capture port (default the first physical one)\n"
+"The frequency (default 440, at most Nyquist) is also where a sweep\n"
+"starts and the impulse rate.\n");
+  exit (status);
+}
+
 int main (int argc, char *argv[])
 {
   jack_client_t *client;
+  const char *client_name = "gensquare";
+  const char *playback = NULL, *capture = NULL;
   const char **ports;
-  double freq;
-  unsigned long sr;
-  unsigned long i;
+  double freq = 440, fend = 20000, seconds = 5, mean;
+  unsigned long sr, count = 0;
+  uint64_t reported = 0, o;
+  jack_nframes_t period;
+  int opt, order = 15, loopback = 0, w;
 
-  if (argc != 2) {
-    printf("Usage: gensquare <frequency>\n");
-    exit(0);
+  if (argc < 2) {
+    usage (EXIT_SUCCESS);
+    }
+  while ((opt = getopt (argc, argv, "w:a:e:t:m:o:n:Lc:i:h")) != -1) {
+    switch (opt) {
+      case 'w':
+        for (w=0; wave_name[w] && strcmp (wave_name[w], optarg); w++);
+        if (wave_name[w] == NULL) {
+          usage (EXIT_FAILURE);
+          }
+        wave = w;
+        break;
+      case 'a':
+        amp = atof (optarg);
+        break;
+      case 'e':
+        fend = atof (optarg);
+        break;
+      case 't':
+        seconds = atof (optarg);
+        break;
+      case 'm':
+        order = atoi (optarg);
+        break;
+      case 'o':
+        playback = optarg;
+        break;
+      case 'n':
+        client_name = optarg;
+        break;
+      case 'L':
+        loopback = 1;
+        break;
+      case 'c':
+        count = atol (optarg);
+        break;
+      case 'i':
+        capture = optarg;
+        break;
+      case 'h':
+        usage (EXIT_SUCCESS);
+      default:
+        usage (EXIT_FAILURE);
+      }
+    }
+  if (optind < argc) {
+    freq = atof (argv[optind]);
+    }
+  if (freq <= 0 || seconds <= 0 || order < 2 || order > 24 || (loopback && order < 8)) {
+    usage (EXIT_FAILURE);
     }
 
-  freq = atof(argv[1]);
-
-  if ((client = jack_client_open("gensquare", (jack_options_t)0, NULL)) == NULL) {
+  if ((client = jack_client_open (client_name, (jack_options_t)0, NULL)) == NULL) {
     fprintf (stderr, "jack server not running?\n");
     return 1;
     }
 
-  for (i=0; i<CYCLEN; i++) {
-    if (i>CYCLEN/2) {
-      cycle[i] = 0.0;
-    } else {
-      cycle[i] = 0.2;
-      }
-    }
-
   sr = jack_get_sample_rate (client);
+  period = jack_get_buffer_size (client);
 
-  fskiplen[0] = freq*CYCLEN/sr;
-  fskiplen[1] = freq*CYCLEN/sr;
-  fskiplen[2] = freq*CYCLEN/sr;
-  fskiplen[3] = freq*CYCLEN/sr;
-  fskiplen[4] = freq*CYCLEN/sr;
-  fskiplen[5] = freq*CYCLEN/sr;
-  fskiplen[6] = freq*CYCLEN/sr;
-  fskiplen[7] = freq*CYCLEN/sr;
+  if (loopback) {
+    build_mls (order);
+    if (setup_correlation ()) {
+      fprintf (stderr, "Could not allocate the correlation.\n");
+      exit (EXIT_FAILURE);
+      }
+    /* two seconds, or two sequences if longer */
+    rb = jack_ringbuffer_create ((sr > table_len ? 2 * sr : 2 * table_len) * sizeof (float));
+    if (rb == NULL) {
+      fprintf (stderr, "Could not allocate the ringbuffer.\n");
+      exit (EXIT_FAILURE);
+      }
+    jack_ringbuffer_mlock (rb);
+  } else {
+    /* at most Nyquist, half a turn per frame, so the square's step fits 32 bits */
+    if (freq > 0.5 * sr) {
+      freq = 0.5 * sr;
+      }
+    switch (wave) {
+      case SQUARE:
+        phase_inc = freq / sr * 4294967296.0;
+        break;
+      case SINE:
+        rot_re = cos (2 * M_PI * freq / sr);
+        rot_im = sin (2 * M_PI * freq / sr);
+        break;
+      case SWEEP:
+        if (fend > 0.45 * sr) {
+          fend = 0.45 * sr;
+          }
+        build_sweep (freq, fend, seconds, sr);
+        break;
+      case IMPULSE:
+        imp_period = (double) sr / freq;
+        break;
+      case MLS:
+        lfsr_taps = mls_taps[order];
+        break;
+      }
+    }
 
   jack_set_process_callback (client, process, 0);
 
   jack_on_shutdown (client, jack_shutdown, 0);
 
+  dspstat_init (client, client_name);
+
   output_port = jack_port_register (client, "output", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+  if (loopback) {
+    input_port = jack_port_register (client, "input", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+    }
+  if (output_port == NULL || (loopback && input_port == NULL)) {
+    fprintf (stderr, "Could not register port.\n");
+    exit (EXIT_FAILURE);
+    }
+
+  if (loopback) {
+    printf ("measuring with a %u frame mls at %lu Hz, period %u\n", table_len, sr, period);
+    fflush (stdout);
+    }
 
   if (jack_activate (client)) {
     fprintf (stderr, "cannot activate client");
     return 1;
     }
 
-  if ((ports = jack_get_ports (client, NULL, NULL, JackPortIsPhysical|JackPortIsInput)) == NULL) {
-    fprintf(stderr, "Cannot find any physical playback ports\n");
-    exit(1);
+  if (playback == NULL) {
+    if ((ports = jack_get_ports (client, NULL, NULL, JackPortIsPhysical|JackPortIsInput)) == NULL) {
+      fprintf(stderr, "Cannot find any physical playback ports\n");
+      exit(1);
+      }
+    if (jack_connect (client, jack_port_name (output_port), ports[0])) {
+      fprintf (stderr, "cannot connect output ports\n");
+      }
+    free (ports);
+  } else if (jack_connect (client, jack_port_name (output_port), playback)) {
+    fprintf (stderr, "cannot connect \"%s\"\n", playback);
+    }
+
+  if (!loopback) {
+    while(1) {
+      sleep (10);
+      }
     }
 
-  if (jack_connect (client, jack_port_name (output_port), ports[0])) {
-    fprintf (stderr, "cannot connect output ports\n");
+  if (capture == NULL) {
+    if ((ports = jack_get_ports (client, NULL, NULL, JackPortIsPhysical|JackPortIsOutput)) == NULL) {
+      fprintf(stderr, "Cannot find any physical capture ports\n");
+      exit(1);
+      }
+    if (jack_connect (client, ports[0], jack_port_name (input_port))) {
+      fprintf (stderr, "cannot connect input ports\n");
+      }
+    free (ports);
+  } else if (jack_connect (client, capture, jack_port_name (input_port))) {
+    fprintf (stderr, "cannot connect \"%s\"\n", capture);
     }
 
-  free (ports);
+#ifndef WIN32
+  signal (SIGHUP, wearedone);
+  signal (SIGINT, wearedone);
+#endif
 
-  while(1) {
-    sleep (10);
+  pthread_mutex_lock (&msg_thread_lock);
+  while (keeprunning && (count == 0 || measured < count)) {
+    pthread_cond_wait (&data_ready, &msg_thread_lock);
+    pthread_mutex_unlock (&msg_thread_lock);
+    drain (sr, period);
+    if ((o = __atomic_load_n (&overruns, __ATOMIC_RELAXED)) != reported) {
+      fprintf (stderr, "overrun: %" PRIu64 " cycles dropped so far\n", o);
+      reported = o;
+      }
+    pthread_mutex_lock (&msg_thread_lock);
     }
+  pthread_mutex_unlock (&msg_thread_lock);
+
+  jack_deactivate (client);
 
+  if (measured) {
+    mean = lat_sum / measured;
+    printf ("%lu measurements: min %.2f max %.2f mean %.2f frames, jitter %.2f peak to peak, %.3f rms\n",
+            measured, lat_min, lat_max, mean, lat_max - lat_min,
+            sqrt (fmax (lat_sumsq / measured - mean * mean, 0)));
+    printf ("%lu measurements: min %.1f max %.1f mean %.1f us, jitter %.1f peak to peak, %.2f rms\n",
+            measured, lat_min * 1e6 / sr, lat_max * 1e6 / sr, mean * 1e6 / sr, (lat_max - lat_min) * 1e6 / sr,
+            sqrt (fmax (lat_sumsq / measured - mean * mean, 0)) * 1e6 / sr);
+    }
+  dspstat_close ();
   jack_client_close (client);
-  exit (0);
+  jack_ringbuffer_free (rb);
+  exit (measured ? 0 : 1);
 }
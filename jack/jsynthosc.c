@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
@@ -6,7 +7,15 @@
 #include <jack/jack.h>
 #include <jack/midiport.h>
 #include <jack/ringbuffer.h>
+#include <jack/thread.h>
 #include <math.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include "dspstat.h"
+#include "denormal.h"
+#include "smf.h"
+#include "wavfile.h"
 
 #ifdef __MINGW32__
 #include <pthread.h>
@@ -22,8 +31,22 @@
 #define MAX(a,b) ( (a) < (b) ? (b) : (a) )
 #endif
 
-#define CYCLEN (8192)
-#define POLYPHONES (16)
+#ifndef MIN
+#define MIN(a,b) ( (a) < (b) ? (a) : (b) )
+#endif
+
+/*
+ * Voices run a 32 bit phase accumulator that wraps for free; the top
+ * CYCBITS select a table entry and the rest drive linear interpolation,
+ * so the table can stay small enough to live in L1 with the voices.
+ */
+#define CYCBITS (11)
+#define CYCLEN (1 << CYCBITS)
+#define FRACBITS (32 - CYCBITS)
+#define FRACMASK ((1u << FRACBITS) - 1)
+#define MAXINC ((1u << 31) - 1)   /* just under Nyquist */
+#define MAXPOLY (1024)
+#define BLOCKLEN (256)
 
 #ifndef PI
 #define PI (3.1415926536)
@@ -33,13 +56,129 @@ jack_port_t *output_port;
 
 static unsigned long sr;
 
-static double pbend = 1.0;
-static double dutyc = 1.0;
-
-
-static jack_default_audio_sample_t cycle[CYCLEN];
+/*
+ * Wavetable bank: for every patch, one band-limited table per octave.
+ * Level L holds harmonics up to (CYCLEN/2)>>L, so a voice picks the
+ * lowest level whose top harmonic stays under Nyquist at its current
+ * increment.  Each table has one guard point for interpolation.
+ */
+#define NPATCHES (4)
+#define NLEVELS (CYCBITS)
+#define OVERSAMPLE (4)
+
+typedef jack_default_audio_sample_t wavetable[NLEVELS][CYCLEN + 1];
+
+static wavetable bank[NPATCHES];
+
+/*
+ * Per-channel controller state.  A voice reads only its own channel's
+ * entry, so a block render touches just the channels that are sounding,
+ * and the whole array fits in a few cache lines.
+ *
+ * Program changes only repoint into the prebuilt bank, at the frame the
+ * message arrived.  The bank is never written after startup, so a table
+ * being played can't tear and nothing has to be reclaimed while the
+ * client is running.
+ */
+typedef struct {
+  const wavetable *patch;
+  double pbend;
+  double pitch;    /* pbend times the current vibrato */
+  uint32_t dutyq;  /* mod wheel duty warp in 16.16 fixed point */
+  int nvoices;
+  /* envelope times in seconds, and the per-tick steps derived from them */
+  double attack, decay, sustain, release;
+  double attack_step, decay_coef, release_coef;
+  /* vibrato LFO */
+  double lfo_phase, lfo_rate, lfo_depth;
+  } chanstate;
+
+static chanstate chans[16];
+
+/*
+ * Envelopes and LFOs run at the control rate: every ctlrate frames
+ * each voice's envelope is stepped and its gain set to ramp linearly
+ * to the new level over the next control period, so the per-sample
+ * cost is a single multiply-add.  Attack is linear, decay and release
+ * are exponential.
+ */
+#define ENV_FLOOR (1e-4)
+
+enum { ENV_ATTACK, ENV_DECAY, ENV_RELEASE };
+
+static int ctlrate = 16;
+static jack_nframes_t ctl_left = 0;
+
+/*
+ * Voice allocator.  Sounding voices sit on a doubly linked list in
+ * note-on order (oldest at vhead), idle ones on a free stack, and
+ * notemap[channel][note] points at the voice playing that key, so
+ * note-on and note-off never scan.  When the pool is exhausted a voice
+ * is stolen per steal_mode: the oldest is O(1); quietest and same-note
+ * walk the sounding list, and only when the pool is full.
+ */
+enum { STEAL_OLDEST, STEAL_QUIETEST, STEAL_SAMENOTE };
+
+static int polyphony = 16;
+static int steal_mode = STEAL_OLDEST;
+
+static uint32_t vinc[MAXPOLY], vphase[MAXPOLY];
+static double fvel[MAXPOLY];
+static uint8_t vstage[MAXPOLY];
+static float venv[MAXPOLY], vgain[MAXPOLY], vdgain[MAXPOLY];
+static uint8_t vchan[MAXPOLY], vnote[MAXPOLY];
+static int16_t vprev[MAXPOLY], vnext[MAXPOLY];
+static int16_t vhead = -1, vtail = -1;
+static int16_t freelist[MAXPOLY];
+static int nfree;
+static int16_t notemap[16][128];
+
+/* scratch for one voice over one block, mixed into the output afterwards */
+static jack_default_audio_sample_t vbuf[BLOCKLEN] __attribute__ ((aligned (32)));
+
+/*
+ * Optional pool of RT worker threads.  A cycle that starts with at
+ * least PARMIN voices per thread becomes a job: the process thread
+ * still steps envelopes, LFOs and MIDI block by block, but instead of
+ * rendering it queues one span per voice per block holding everything
+ * that block needs.  The workers are woken once at the end of the
+ * cycle; each renders the spans of its own voices into a private
+ * partial buffer while the process thread takes share 0, and the
+ * partials are summed once everyone has posted workers_done.  Cycles
+ * longer than JOBLEN frames or MAXSPANS spans are flushed in pieces.
+ */
+#define MAXWORKERS (16)
+#define PARMIN (4)
+#define JOBLEN (4096)
+#define MAXSPANS (16384)
+
+/* one voice over one block, frozen when the block was stepped */
+typedef struct {
+  const jack_default_audio_sample_t *cycle;
+  uint32_t inc;
+  uint32_t duty;
+  jack_default_audio_sample_t g, dg;
+  int16_t v;
+  uint16_t off, n;
+  } span;
 
-static double fskiplen[POLYPHONES], fpos[POLYPHONES], fvel[POLYPHONES];
+typedef struct {
+  jack_native_thread_t thread;
+  sem_t go;
+  int share;
+  jack_default_audio_sample_t vbuf[BLOCKLEN] __attribute__ ((aligned (32)));
+  jack_default_audio_sample_t part[JOBLEN] __attribute__ ((aligned (32)));
+  } worker;
+
+static int nworkers = 0;
+static worker workers[MAXWORKERS];
+static sem_t workers_done;
+static int workers_quit = 0;
+
+static jack_default_audio_sample_t *job_out;  /* NULL unless a job is open */
+static jack_nframes_t job_n;
+static span spans[MAXSPANS];
+static int job_nspans;
 
 static jack_port_t* port;
 static jack_ringbuffer_t *rb = NULL;
@@ -47,6 +186,8 @@ static pthread_mutex_t msg_thread_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t data_ready = PTHREAD_COND_INITIALIZER;
 
 static int keeprunning = 1;
+/* set once main() is reading rb; until then process() does not queue */
+static int describing = 0;
 static uint64_t monotonic_cnt = 0;
 
 #define RBSIZE 512
@@ -65,122 +206,700 @@ void error_cb(const char *msg)
 
 
 
-static void handlemsg (midimsg* event)
+/* the naive single-cycle shapes behind the program numbers, x in [0,1) */
+static double naive_wave (int p, double x)
+{
+  switch (p) {
+    case 0:
+      return x > 0.5 ? 0.0 : 0.2;
+    case 1:
+      return x < 0.5 ? 0.4*x : 0.4*(1-x);
+    case 2:
+      return 0.2*sin(2*PI*x);
+    default:
+      return 0.2*x;
+    }
+}
+
+/*
+ * Fill bank[][][] from the Fourier series of each naive shape.  Runs
+ * once at startup; the DFT and the resynthesis both index a shared
+ * cosine table instead of calling sin/cos, so this takes a few tens of
+ * milliseconds.
+ */
+static void build_bank (void)
+{
+  const int M = CYCLEN * OVERSAMPLE;
+  const int H = CYCLEN / 2;
+  static double costab[CYCLEN * OVERSAMPLE];
+  static double x[CYCLEN * OVERSAMPLE];
+  static double re[CYCLEN / 2 + 1], im[CYCLEN / 2 + 1];
+  static double acc[CYCLEN];
+  int p, h, m, i, l, top;
+
+  for (m=0; m<M; m++) {
+    costab[m] = cos(2*PI*m/M);
+    }
+
+  for (p=0; p<NPATCHES; p++) {
+    for (m=0; m<M; m++) {
+      x[m] = naive_wave (p, (double) m/M);
+      }
+    for (h=0; h<=H; h++) {
+      re[h] = im[h] = 0;
+      for (m=0; m<M; m++) {
+        re[h] += x[m] * costab[(long) h*m % M];
+        im[h] += x[m] * costab[((long) h*m + 3*M/4) % M];
+        }
+      re[h] *= 2.0/M;
+      im[h] *= 2.0/M;
+      }
+
+    /* build from the top level down, adding each octave's harmonics */
+    for (i=0; i<CYCLEN; i++) {
+      acc[i] = re[0] / 2;
+      }
+    top = 0;
+    for (l=NLEVELS-1; l>=0; l--) {
+      for (h=top+1; h<=(H >> l); h++) {
+        for (i=0; i<CYCLEN; i++) {
+          acc[i] += re[h] * costab[(long) h*i*OVERSAMPLE % M] + im[h] * costab[((long) h*i*OVERSAMPLE + 3*M/4) % M];
+          }
+        }
+      top = H >> l;
+      for (i=0; i<CYCLEN; i++) {
+        bank[p][l][i] = acc[i];
+        }
+      bank[p][l][CYCLEN] = bank[p][l][0];
+      }
+    }
+}
+
+/* table level whose top harmonic stays below Nyquist at increment inc */
+static int mip_level (uint32_t inc)
+{
+  int l;
+
+  if (inc <= (1u << FRACBITS)) {
+    return 0;
+    }
+  l = 32 - __builtin_clz (inc - 1) - FRACBITS;
+  return l < NLEVELS ? l : NLEVELS - 1;
+}
+
+/* a phase increment, held below Nyquist so it fits in 32 bits */
+static inline uint32_t clamp_inc (double inc)
+{
+  return inc < MAXINC ? (uint32_t) inc : MAXINC;
+}
+
+/* phase increment per frame for a MIDI note */
+static uint32_t note_inc (uint8_t note)
+{
+  return clamp_inc (round (32*exp2(note/12.0) / sr * 4294967296.0));
+}
+
+/* MIDI 0-127 to 1ms .. 8s, roughly exponential */
+static double cc_time (uint8_t val)
+{
+  return 0.001 * exp2 (val * 13.0 / 127);
+}
+
+static void channel_update_env (chanstate *c)
+{
+  const double tick = (double) ctlrate / sr;
+
+  c->attack_step = tick / c->attack;
+  c->decay_coef = exp (-tick / c->decay);
+  c->release_coef = exp (-tick / c->release);
+}
+
+static void channel_init (void)
 {
   int i;
 
+  for (i=0; i<16; i++) {
+    chans[i].patch = &bank[0];
+    chans[i].pbend = 1.0;
+    chans[i].pitch = 1.0;
+    chans[i].dutyq = 1 << 16;
+    chans[i].nvoices = 0;
+    chans[i].attack = 0.002;
+    chans[i].decay = 0.2;
+    chans[i].sustain = 1.0;
+    chans[i].release = 0.03;
+    chans[i].lfo_phase = 0;
+    chans[i].lfo_rate = 5.0;
+    chans[i].lfo_depth = 0;
+    channel_update_env (&chans[i]);
+    }
+}
+
+static void voice_init (void)
+{
+  int i, j;
+
+  for (i=0; i<16; i++) {
+    for (j=0; j<128; j++) {
+      notemap[i][j] = -1;
+      }
+    }
+  nfree = 0;
+  for (i=polyphony-1; i>=0; i--) {
+    freelist[nfree++] = i;
+    }
+}
+
+static void voice_unlink (int v)
+{
+  if (vprev[v] >= 0) {
+    vnext[vprev[v]] = vnext[v];
+  } else {
+    vhead = vnext[v];
+    }
+  if (vnext[v] >= 0) {
+    vprev[vnext[v]] = vprev[v];
+  } else {
+    vtail = vprev[v];
+    }
+}
+
+static void voice_append (int v)
+{
+  vprev[v] = vtail;
+  vnext[v] = -1;
+  if (vtail >= 0) {
+    vnext[vtail] = v;
+  } else {
+    vhead = v;
+    }
+  vtail = v;
+}
+
+static void voice_free (int v)
+{
+  voice_unlink (v);
+  chans[vchan[v]].nvoices--;
+  if (notemap[vchan[v]][vnote[v]] == v) {
+    notemap[vchan[v]][vnote[v]] = -1;
+    }
+  vinc[v] = 0;
+  freelist[nfree++] = v;
+}
+
+/* pick a sounding voice to take over when the pool is exhausted */
+static int voice_steal (uint8_t note)
+{
+  int v, best = vhead;
+
+  switch (steal_mode) {
+    case STEAL_QUIETEST:
+      for (v = vhead; v >= 0; v = vnext[v]) {
+        if (vgain[v] < vgain[best]) {
+          best = v;
+          }
+        }
+      break;
+    case STEAL_SAMENOTE:
+      for (v = vhead; v >= 0; v = vnext[v]) {
+        if (vnote[v] == note) {
+          best = v;
+          break;
+          }
+        }
+      break;
+    default:
+      break;
+    }
+  return best;
+}
+
+/*
+ * Advance one voice's envelope by a control tick and set its gain to
+ * ramp there over the next frames.  Returns 0 once a released voice
+ * has decayed below ENV_FLOOR and can be freed.
+ */
+static int voice_ramp (int v, jack_nframes_t frames)
+{
+  const chanstate *c = &chans[vchan[v]];
+  double env = venv[v];
+
+  switch (vstage[v]) {
+    case ENV_ATTACK:
+      env += c->attack_step;
+      if (env >= 1.0) {
+        env = 1.0;
+        vstage[v] = ENV_DECAY;
+        }
+      break;
+    case ENV_DECAY:
+      env = c->sustain + (env - c->sustain) * c->decay_coef;
+      if (fabs (env - c->sustain) < ENV_FLOOR * ENV_FLOOR) {
+        /* settled; stop the tail decaying into denormals */
+        env = c->sustain;
+        }
+      break;
+    default:
+      env *= c->release_coef;
+      if (env < ENV_FLOOR) {
+        return 0;
+        }
+      break;
+    }
+
+  venv[v] = env;
+  vdgain[v] = (env * fvel[v] - vgain[v]) / frames;
+  return 1;
+}
+
+static void note_on (uint8_t chan, uint8_t note, uint8_t vel)
+{
+  int v = notemap[chan][note];
+
+  if (v >= 0) {
+    /* retrigger the key that is already sounding, from its current level */
+    voice_unlink (v);
+    chans[vchan[v]].nvoices--;
+  } else if (nfree > 0) {
+    v = freelist[--nfree];
+    venv[v] = vgain[v] = 0;
+  } else {
+    v = voice_steal (note);
+    voice_unlink (v);
+    chans[vchan[v]].nvoices--;
+    if (notemap[vchan[v]][vnote[v]] == v) {
+      notemap[vchan[v]][vnote[v]] = -1;
+      }
+    }
+
+  vinc[v] = note_inc (note);
+  fvel[v] = vel/127.0;
+  vchan[v] = chan;
+  vnote[v] = note;
+  vstage[v] = ENV_ATTACK;
+  notemap[chan][note] = v;
+  chans[chan].nvoices++;
+  voice_append (v);
+
+  /* start the attack now rather than at the next control tick */
+  voice_ramp (v, ctl_left ? ctl_left : ctlrate);
+}
+
+static void note_off (uint8_t chan, uint8_t note)
+{
+  int v = notemap[chan][note];
+
+  if (v >= 0) {
+    vstage[v] = ENV_RELEASE;
+    notemap[chan][note] = -1;
+    }
+}
+
+/* step every sounding channel's LFO and every voice's envelope */
+static void control_tick (void)
+{
+  const double tick = (double) ctlrate / sr;
+  chanstate *c;
+  int i, v, next;
+
+  for (i=0; i<16; i++) {
+    c = &chans[i];
+    if (c->nvoices == 0) {
+      continue;
+      }
+    c->lfo_phase += c->lfo_rate * tick;
+    c->lfo_phase -= floor (c->lfo_phase);
+    c->pitch = c->pbend;
+    if (c->lfo_depth > 0) {
+      c->pitch *= exp2 (c->lfo_depth / 12 * sin (2*PI*c->lfo_phase));
+      }
+    }
+
+  for (v = vhead; v >= 0; v = next) {
+    next = vnext[v];
+    if (!voice_ramp (v, ctlrate)) {
+      voice_free (v);
+      }
+    }
+}
+
+/*
+ * Apply one MIDI message to the synth state.  Called from process() at
+ * the message's frame offset, so it must not block or print; describe()
+ * does the talking from the message thread.
+ */
+static void handlemsg (midimsg* event)
+{
   if (event->size == 0) {
     return;
     }
 
   uint8_t type = event->buffer[0] & 0xf0;
   uint8_t channel = event->buffer[0] & 0xf;
+  chanstate *c;
+  double bend;
 
   switch (type) {
     case 0x90:
-      assert (event->size == 3);
-      printf(" ON: chan %2d vel %3d freq %f\n", channel, event->buffer[2], 32*exp2(event->buffer[1]/12.0));
-      for (i=0; i<POLYPHONES; i++) {
-        if (fskiplen[i] < .001) {
-          fskiplen[i] = (32*exp2(event->buffer[1]/12.0))*CYCLEN/sr;
-          fvel[i] = event->buffer[2]/127.0;
-          break;
-          }
+      if (event->size != 3) {
+        break;
+        }
+      if (event->buffer[2] == 0) {
+        note_off (channel, event->buffer[1] & 0x7f);
+      } else {
+        note_on (channel, event->buffer[1] & 0x7f, event->buffer[2]);
         }
       break;
     case 0x80:
-      assert (event->size == 3);
-      // printf("OFF: chan %2d vel %3d freq %f\n", channel, event->buffer[2], exp2(event->buffer[1]/12.0));
-      for (i=0; i<POLYPHONES; i++) {
-        if (fskiplen[i] - (32*exp2(event->buffer[1]/12.0))*CYCLEN/sr < .001 && fskiplen[i] - (32*exp2(event->buffer[1]/12.0))*CYCLEN/sr > -.001) {
-          fskiplen[i] = 0;
-          }
+      if (event->size != 3) {
+        break;
         }
+      note_off (channel, event->buffer[1] & 0x7f);
       break;
     case 0xb0:
-      assert (event->size == 3);
-      printf(" CC: chan %2d ctl %3d  val %3d\n", channel, event->buffer[1], event->buffer[2]);
+      if (event->size != 3) {
+        break;
+        }
+      c = &chans[channel];
       switch (event->buffer[1]) {
         case 0x01:
-          dutyc = 1+ ((event->buffer[2] - 63.0)/128.0);
-          printf("%f", dutyc);
+          c->dutyq = lround ((1+ ((event->buffer[2] - 63.0)/128.0)) * 65536);
+          break;
+        case 72:
+          c->release = cc_time (event->buffer[2]);
+          channel_update_env (c);
+          break;
+        case 73:
+          c->attack = cc_time (event->buffer[2]);
+          channel_update_env (c);
+          break;
+        case 75:
+          c->decay = cc_time (event->buffer[2]);
+          channel_update_env (c);
+          break;
+        case 76:
+          c->lfo_rate = 0.1 * exp2 (event->buffer[2] * 8.0 / 127);
+          break;
+        case 77:
+          c->lfo_depth = event->buffer[2] / 127.0;
+          break;
+        case 79:
+          c->sustain = event->buffer[2] / 127.0;
           break;
         }
       break;
     case 0xc0:
       // patch
-      printf("%d\n", event->size);
-      assert (event->size == 2);
-      printf("PCH: chan %d %d\n", channel, event->buffer[1]);
-        switch (event->buffer[1]) {
-          case 0x01:
-            for (i=0; i<CYCLEN; i++) {
-              if (i>CYCLEN/2+1) {
-                cycle[i] = 0.0;
-              } else {
-                cycle[i] = 0.2;
-                }
-              }
-            break;
-          case 0x02:
-            for (i=0; i<CYCLEN; i++) {
-              if (i<CYCLEN/2) {
-                cycle[i] = 0.4*i/CYCLEN;
-              } else {
-                cycle[i] = 0.4*(CYCLEN-i)/CYCLEN;
-                }
-              }
-            break;
-          case 0x03:
-            for (i=0; i<CYCLEN; i++) {
-              cycle[i] = 0.2*sin(2*PI*i/CYCLEN);
-              }
-            break;
-          case 0x04:
-            for (i=0; i<CYCLEN; i++) {
-                cycle[i] = 0.2*i/CYCLEN;
-                }
-            break;
-            }
-          break;
+      if (event->size != 2) {
+        break;
+        }
+      if (event->buffer[1] >= 1 && event->buffer[1] <= NPATCHES) {
+        chans[channel].patch = &bank[event->buffer[1] - 1];
+        }
+      break;
     case 0xe0:
       // pitch
-      assert (event->size == 3);
-      pbend = 1 + (((event->buffer[2]-64.0)/64.0) / 12.0);
+      if (event->size != 3) {
+        break;
+        }
+      c = &chans[channel];
+      bend = 1 + (((event->buffer[2]-64.0)/64.0) / 12.0);
+      c->pitch *= bend / c->pbend;
+      c->pbend = bend;
+      break;
+    default:
+      break;
+    }
+}
+
+static void describe (midimsg* event)
+{
+  if (event->size == 0) {
+    return;
+    }
+
+  uint8_t type = event->buffer[0] & 0xf0;
+  uint8_t channel = event->buffer[0] & 0xf;
+
+  switch (type) {
+    case 0x90:
+      printf("%4d: ON: chan %2d vel %3d freq %f\n", event->tme_rel, channel, event->buffer[2], 32*exp2(event->buffer[1]/12.0));
+      break;
+    case 0xb0:
+      printf("%4d:  CC: chan %2d ctl %3d  val %3d\n", event->tme_rel, channel, event->buffer[1], event->buffer[2]);
+      break;
+    case 0xc0:
+      printf("%4d: PCH: chan %d %d\n", event->tme_rel, channel, event->buffer[1]);
       break;
     default:
       break;
     }
 }
 
+/*
+ * Freeze what voice v needs for its next n frames, and step its gain on
+ * to where the block will leave it.  The gain ramp is only ever rebased
+ * at control ticks, so this keeps the voice list consistent for
+ * stealing and ramps without waiting for the samples.
+ */
+static void span_setup (span *s, int v, jack_nframes_t off, jack_nframes_t n)
+{
+  const chanstate *c = &chans[vchan[v]];
+  const uint32_t inc = clamp_inc ((double) vinc[v] * c->pitch);
+  /* the duty warp steps through the table duty/65536 times as fast */
+  const uint64_t step = (uint64_t) inc * c->dutyq >> 16;
+
+  s->cycle = (*c->patch)[mip_level (step > UINT32_MAX ? UINT32_MAX : step)];
+  s->inc = inc;
+  s->duty = c->dutyq;
+  s->g = vgain[v];
+  s->dg = vdgain[v];
+  s->v = v;
+  s->off = off;
+  s->n = n;
+  vgain[v] += vdgain[v] * n;
+}
+
+/* run one span into dst; only the span's voice phase is touched */
+static void render_span (const span *s, jack_default_audio_sample_t * restrict dst)
+{
+  const jack_default_audio_sample_t *cycle = s->cycle;
+  const uint32_t inc = s->inc;
+  const uint64_t duty = s->duty;
+  const jack_default_audio_sample_t dg = s->dg;
+  const jack_nframes_t n = s->n;
+  uint32_t ph = vphase[s->v];
+  uint32_t w, idx;
+  jack_default_audio_sample_t g = s->g;
+  jack_default_audio_sample_t fr, a;
+  jack_nframes_t i;
+
+  for (i=0; i<n; i++) {
+    ph += inc;
+    /* the duty warp scales phase and lets it wrap, as pos*dutyc%CYCLEN did */
+    w = (ph * duty) >> 16;
+    idx = w >> FRACBITS;
+    fr = (w & FRACMASK) * (1.0f / (1u << FRACBITS));
+    a = cycle[idx];
+    dst[i] = (a + (cycle[idx+1] - a) * fr) * g;
+    g += dg;
+    }
+
+  vphase[s->v] = ph;
+}
+
+static void mix_add (jack_default_audio_sample_t * restrict dst, const jack_default_audio_sample_t * restrict src, jack_nframes_t n)
+{
+  jack_nframes_t i;
+
+  for (i=0; i<n; i++) {
+    dst[i] += src[i];
+    }
+}
+
+/*
+ * Add the job's spans for every (nworkers+1)th voice, starting at share.
+ * A voice's spans are queued in time order and always land in the same
+ * share, so its phase runs on unbroken.
+ */
+static void render_share (int share, jack_default_audio_sample_t *dst, jack_default_audio_sample_t *scratch)
+{
+  int i;
+
+  for (i = 0; i < job_nspans; i++) {
+    if (spans[i].v % (nworkers + 1) == share) {
+      render_span (&spans[i], scratch);
+      mix_add (dst + spans[i].off, scratch, spans[i].n);
+      }
+    }
+}
+
+static void* worker_main (void *arg)
+{
+  worker *w = (worker *) arg;
+
+  denormals_off ();
+  for (;;) {
+    sem_wait (&w->go);
+    if (workers_quit) {
+      break;
+      }
+    memset (w->part, 0, sizeof (jack_default_audio_sample_t) * job_n);
+    render_share (w->share, w->part, w->vbuf);
+    sem_post (&workers_done);
+    }
+  return NULL;
+}
+
+/* without a client (offline rendering) the workers are plain threads */
+static int start_workers (jack_client_t *client)
+{
+  int prio = client ? jack_client_real_time_priority (client) : -1;
+  int i, r;
+
+  sem_init (&workers_done, 0, 0);
+  for (i=0; i<nworkers; i++) {
+    workers[i].share = i + 1;
+    sem_init (&workers[i].go, 0, 0);
+    if (client) {
+      r = jack_client_create_thread (client, &workers[i].thread, prio, prio >= 0, worker_main, &workers[i]);
+    } else {
+      r = pthread_create (&workers[i].thread, NULL, worker_main, &workers[i]);
+      }
+    if (r) {
+      fprintf (stderr, "Could not start worker thread %d.\n", i);
+      nworkers = i;
+      return -1;
+      }
+    }
+  return 0;
+}
+
+static void stop_workers (void)
+{
+  int i;
+
+  workers_quit = 1;
+  for (i=0; i<nworkers; i++) {
+    sem_post (&workers[i].go);
+    pthread_join (workers[i].thread, NULL);
+    }
+}
+
+/* render the queued spans across the pool and start an empty job at out */
+static void job_flush (jack_default_audio_sample_t *out)
+{
+  int i;
+
+  if (job_nspans > 0) {
+    for (i=0; i<nworkers; i++) {
+      sem_post (&workers[i].go);
+      }
+    render_share (0, job_out, vbuf);
+    for (i=0; i<nworkers; i++) {
+      sem_wait (&workers_done);
+      }
+    for (i=0; i<nworkers; i++) {
+      mix_add (job_out, workers[i].part, job_n);
+      }
+    }
+  job_out = out;
+  job_n = 0;
+  job_nspans = 0;
+}
+
+/* open a job for the cycle at out when it is worth waking the pool */
+static void cycle_begin (jack_default_audio_sample_t *out)
+{
+  job_out = NULL;
+  if (nworkers > 0 && polyphony - nfree >= PARMIN * (nworkers + 1)) {
+    job_flush (out);
+    }
+}
+
+static void cycle_end (void)
+{
+  if (job_out) {
+    job_flush (NULL);
+    }
+}
+
+/*
+ * Voice-major render: each sounding voice is run over a whole block
+ * and summed into the output, so idle voices cost one test per block
+ * rather than one per sample, and the summing loop vectorizes.
+ * Blocks also end on control ticks.  Adds into out, which the caller
+ * clears once per cycle; inside a job the blocks are only queued, and
+ * land in out at cycle_end().
+ */
+static void render (jack_default_audio_sample_t *out, jack_nframes_t frames)
+{
+  jack_nframes_t done, n;
+  span s;
+  int j;
+
+  for (done = 0; done < frames; done += n) {
+    if (ctl_left == 0) {
+      control_tick ();
+      ctl_left = ctlrate;
+      }
+    n = MIN(frames - done, MIN(BLOCKLEN, ctl_left));
+    ctl_left -= n;
+    if (job_out) {
+      if (out + done + n > job_out + JOBLEN || job_nspans + (polyphony - nfree) > MAXSPANS) {
+        job_flush (out + done);
+        }
+      for (j = vhead; j >= 0; j = vnext[j]) {
+        span_setup (&spans[job_nspans++], j, out + done - job_out, n);
+        }
+      job_n = out + done + n - job_out;
+      continue;
+      }
+    for (j = vhead; j >= 0; j = vnext[j]) {
+      span_setup (&s, j, 0, n);
+      render_span (&s, vbuf);
+      mix_add (out + done, vbuf, n);
+      }
+    }
+}
+
+/* render out up to the message's frame, then apply it there */
+static void render_event (jack_default_audio_sample_t *out, jack_nframes_t *done, midimsg *m)
+{
+  if (m->tme_rel > *done) {
+    render (out + *done, m->tme_rel - *done);
+    *done = m->tme_rel;
+    }
+  handlemsg (m);
+}
+
 int process (jack_nframes_t frames, void* arg)
 {
-  unsigned long j, pos;
+  const uint64_t t0 = dspstat_begin ();
   void* buffer;
   jack_nframes_t N;
   jack_nframes_t i;
 
+  jack_default_audio_sample_t *out = (jack_default_audio_sample_t *) jack_port_get_buffer (output_port, frames);
+  jack_nframes_t done = 0;
+
   buffer = jack_port_get_buffer (port, frames);
   assert (buffer);
 
+  memset (out, 0, sizeof (jack_default_audio_sample_t) * frames);
+  cycle_begin (out);
+
+  /* split the render at each event so it lands on its own frame */
   N = jack_midi_get_event_count (buffer);
   for (i = 0; i < N; ++i) {
     jack_midi_event_t event;
+    midimsg m;
     int r;
 
     r = jack_midi_event_get (&event, buffer, i);
+    if (r != 0) {
+      continue;
+      }
 
-    if (r == 0 && jack_ringbuffer_write_space (rb) >= sizeof(midimsg)) {
-      midimsg m;
-      m.tme_mon = monotonic_cnt;
-      m.tme_rel = event.time;
-      m.size    = event.size;
-      memcpy (m.buffer, event.buffer, MAX(sizeof(m.buffer), event.size));
+    m.tme_mon = monotonic_cnt;
+    m.tme_rel = MIN(event.time, frames);
+    m.size    = MIN(sizeof(m.buffer), event.size);
+    memcpy (m.buffer, event.buffer, m.size);
+    render_event (out, &done, &m);
+
+    if (!__atomic_load_n (&describing, __ATOMIC_ACQUIRE)) {
+      continue;
+      }
+    if (jack_ringbuffer_write_space (rb) >= sizeof(midimsg)) {
       jack_ringbuffer_write (rb, (void *) &m, sizeof(midimsg));
+    } else {
+      dspstat_dropped (1);
       }
-
     }
 
+  render (out + done, frames - done);
+  cycle_end ();
+
   monotonic_cnt += frames;
 
   if (pthread_mutex_trylock (&msg_thread_lock) == 0) {
@@ -188,57 +907,184 @@ int process (jack_nframes_t frames, void* arg)
     pthread_mutex_unlock (&msg_thread_lock);
     }
 
-  jack_default_audio_sample_t *out = (jack_default_audio_sample_t *) jack_port_get_buffer (output_port, frames);
+  dspstat_end (t0, frames);
+  return 0;
+}
+
+static void wearedone(int sig) 
+{
+  keeprunning = 0;
+}
+
+/*
+ * Offline render: play a Standard MIDI File through the same render()
+ * and handlemsg() path as process(), in OFFLINE_PERIOD cycles, as fast
+ * as the CPU allows, and write the result to a WAV file.  After the
+ * last event it keeps going until every voice has released, for at
+ * most TAIL_SECONDS.
+ */
+#define OFFLINE_PERIOD (256)
+#define TAIL_SECONDS (30)
+
+static int render_offline (const char *midifile, const char *wavpath)
+{
+  static jack_default_audio_sample_t out[OFFLINE_PERIOD];
+  smf_event *ev;
+  size_t nev, e = 0;
+  wavfile wav;
+  uint64_t pos, tail_end = 0;
+  struct timespec t0, t1;
+  double secs;
+
+  denormals_off ();
+  if ((ev = smf_load (midifile, sr, &nev)) == NULL) {
+    fprintf (stderr, "Could not read MIDI file %s.\n", midifile);
+    return -1;
+    }
+  if (wav_create (&wav, wavpath, 1, sr)) {
+    fprintf (stderr, "Could not create %s.\n", wavpath);
+    free (ev);
+    return -1;
+    }
+
+  clock_gettime (CLOCK_MONOTONIC, &t0);
 
-  for (i=0; i<frames; i++) {
-    out[i] = 0;
-    for (j=0; j<POLYPHONES; j++) {
-      if (fskiplen[j] > 0.0001) {
-        fpos[j] += fskiplen[j]*pbend;
-        pos = fpos[j];
-        pos %= CYCLEN;
-        out[i] += cycle[lround(pos*dutyc)%CYCLEN]*fvel[j];
+  for (pos = 0; ; pos += OFFLINE_PERIOD) {
+    jack_nframes_t done = 0;
+
+    if (e == nev) {
+      if (tail_end == 0) {
+        tail_end = pos + (uint64_t) TAIL_SECONDS * sr;
+        }
+      if (vhead < 0 || pos >= tail_end) {
+        break;
         }
       }
+
+    memset (out, 0, sizeof (out));
+    cycle_begin (out);
+    for (; e < nev && ev[e].frame < pos + OFFLINE_PERIOD; e++) {
+      midimsg m;
+      m.tme_mon = pos;
+      m.tme_rel = ev[e].frame > pos ? ev[e].frame - pos : 0;
+      m.size    = ev[e].size;
+      memcpy (m.buffer, ev[e].data, ev[e].size);
+      render_event (out, &done, &m);
+      }
+    render (out + done, OFFLINE_PERIOD - done);
+    cycle_end ();
+
+    if (wav_write (&wav, out, OFFLINE_PERIOD)) {
+      fprintf (stderr, "Could not write %s.\n", wavpath);
+      break;
+      }
     }
 
-  return 0;
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+  printf ("rendered %" PRIu64 " frames (%.2f s of audio) in %.3f s: %.0f frames/s, %.1fx realtime\n",
+          pos, (double) pos / sr, secs, pos / secs, pos / secs / sr);
+
+  free (ev);
+  return wav_close (&wav);
 }
 
-static void wearedone(int sig) 
+static void usage (int status)
 {
-  keeprunning = 0;
+  printf ("jsynthosc - JACK MIDI wavetable synth.\n\n");
+  printf ("Usage: jsynthosc [ OPTIONS ]\n\n");
+  printf ("Options:\n\
+  -h        display this help and exit\n\
+  -r file   render a Standard MIDI File offline instead of running on JACK\n\
+  -o file   WAV file for -r (default jsynthosc.wav)\n\
+  -R rate   sample rate for -r (default 48000)\n\
+  -k frames control rate for envelopes and LFOs (1-%d, default 16)\n\
+  -j n      render voices on n extra RT worker threads (0-%d, default 0)\n\
+  -p voices polyphony (1-%d, default 16)\n\
+  -s mode   voice stealing when out of voices: oldest, quietest, samenote\n\
+\n", BLOCKLEN, MAXWORKERS, MAXPOLY);
+  exit (status);
 }
 
 int main (int argc, char* argv[])
 {
   jack_client_t* client;
-  char const default_name[] = "jsynthosc";
-  char const * client_name;
-  int time_format = 0;
   int r;
   const char **ports;
   int i;
+  long rate;
+  int opt;
+  const char *midifile = NULL;
+  const char *wavpath = "jsynthosc.wav";
+
+  sr = 48000;
+
+  while ((opt = getopt (argc, argv, "hj:k:o:p:r:R:s:")) != -1) {
+    switch (opt) {
+      case 'j':
+        nworkers = atoi (optarg);
+        if (nworkers < 0 || nworkers > MAXWORKERS) {
+          fprintf (stderr, "invalid worker count\n");
+          exit (EXIT_FAILURE);
+          }
+        break;
+      case 'k':
+        ctlrate = atoi (optarg);
+        if (ctlrate < 1 || ctlrate > BLOCKLEN) {
+          fprintf (stderr, "invalid control rate\n");
+          exit (EXIT_FAILURE);
+          }
+        break;
+      case 'r':
+        midifile = optarg;
+        break;
+      case 'o':
+        wavpath = optarg;
+        break;
+      case 'R':
+        rate = atol (optarg);
+        if (rate <= 0) {
+          usage (EXIT_FAILURE);
+          }
+        sr = rate;
+        break;
+      case 'p':
+        polyphony = atoi (optarg);
+        if (polyphony < 1 || polyphony > MAXPOLY) {
+          fprintf (stderr, "invalid polyphony\n");
+          exit (EXIT_FAILURE);
+          }
+        break;
+      case 's':
+        if (!strcmp (optarg, "oldest")) {
+          steal_mode = STEAL_OLDEST;
+        } else if (!strcmp (optarg, "quietest")) {
+          steal_mode = STEAL_QUIETEST;
+        } else if (!strcmp (optarg, "samenote")) {
+          steal_mode = STEAL_SAMENOTE;
+        } else {
+          usage (EXIT_FAILURE);
+          }
+        break;
+      case 'h':
+        usage (EXIT_SUCCESS);
+      default:
+        usage (EXIT_FAILURE);
+      }
+    }
 
+  build_bank ();
 
-  int cn = 1;
-
-
-  fskiplen[0] = 0;
-  fskiplen[1] = 0;
-  fskiplen[2] = 0;
-  fskiplen[3] = 0;
-  fskiplen[4] = 0;
-  fskiplen[5] = 0;
-  fskiplen[6] = 0;
-  fskiplen[7] = 0;
-
-  for (i=0; i<CYCLEN; i++) {
-    if (i>CYCLEN/2) {
-      cycle[i] = 0.0;
-    } else {
-      cycle[i] = 0.2;
+  if (midifile) {
+    channel_init ();
+    voice_init ();
+    if (nworkers > 0 && start_workers (NULL)) {
+      fprintf (stderr, "Continuing with %d worker threads.\n", nworkers);
       }
+    r = render_offline (midifile, wavpath);
+    stop_workers ();
+    return r ? EXIT_FAILURE : EXIT_SUCCESS;
     }
 
   jack_set_error_function(error_cb);
@@ -250,9 +1096,19 @@ int main (int argc, char* argv[])
 
   sr = jack_get_sample_rate (client);
 
+  channel_init ();
+  voice_init ();
+
+  if (nworkers > 0 && start_workers (client)) {
+    fprintf (stderr, "Continuing with %d worker threads.\n", nworkers);
+    }
+
   rb = jack_ringbuffer_create (RBSIZE * sizeof(midimsg));
 
+  dspstat_init (client, "jsynthosc");
+
   jack_set_process_callback (client, process, 0);
+  jack_set_thread_init_callback (client, denormal_thread_init, 0);
 
   port = jack_port_register (client, "input", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
   if (port == NULL) {
@@ -319,16 +1175,16 @@ int main (int argc, char* argv[])
 #endif
 
   pthread_mutex_lock (&msg_thread_lock);
+  __atomic_store_n (&describing, 1, __ATOMIC_RELEASE);
 
   while (keeprunning) {
     const int mqlen = jack_ringbuffer_read_space (rb) / sizeof(midimsg);
     int i;
     for (i=0; i < mqlen; ++i) {
-      size_t j;
       midimsg m;
       jack_ringbuffer_read(rb, (char*) &m, sizeof(midimsg));
 
-      handlemsg (&m);
+      describe (&m);
       }
     fflush (stdout);
     pthread_cond_wait (&data_ready, &msg_thread_lock);
@@ -336,6 +1192,8 @@ int main (int argc, char* argv[])
   pthread_mutex_unlock (&msg_thread_lock);
   
   jack_deactivate (client);
+  dspstat_close ();
+  stop_workers ();
   jack_client_close (client);
   jack_ringbuffer_free (rb);
   
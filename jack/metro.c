@@ -24,23 +24,69 @@
 #include <math.h>
 #include <jack/jack.h>
 #include <jack/transport.h>
+#include <jack/midiport.h>
+#include <jack/ringbuffer.h>
 #include <getopt.h>
 #include <string.h>
+#include <signal.h>
+
+#include "dspstat.h"
 
 typedef jack_default_audio_sample_t sample_t;
 
-const double PI = 3.14;
+/* a tempo and/or meter change from the main thread; 0 leaves it alone */
+typedef struct {
+        double bpm;
+        float beats_per_bar;
+} tempo_msg;
+
+#define TEMPO_QUEUE 16
+#define TICKS_PER_BEAT 1920.0
+#define GRID_SLACK 1e-4         /* frames of rounding forgiven when placing a click */
+#define CLOCK_PPQN 24
+
+#define MIDI_SPP 0xf2
+#define MIDI_CLOCK 0xf8
+#define MIDI_START 0xfa
+#define MIDI_CONTINUE 0xfb
+#define MIDI_STOP 0xfc
 
 jack_client_t *client;
 jack_port_t *output_port;
+jack_port_t *clock_port;
 unsigned long sr;
 int freq = 880;
-int bpm;
-jack_nframes_t tone_length, wave_length;
-sample_t *wave;
-long offset = 0;
+int accent_freq = 0;
+double bpm;
+int beats_per_bar = 4;
+jack_nframes_t tone_length;
+sample_t *click, *accent;
 int transport_aware = 0;
-jack_transport_state_t transport_state;
+int timebase_master = 0;
+jack_ringbuffer_t *tempo_rb;
+volatile sig_atomic_t keeprunning = 1;
+
+/* The beat grid, touched by the process thread only.  Nothing but the
+   click itself is stored: silence is counted, and the distance to the
+   next beat is kept in fractional frames so the grid never drifts. */
+double frames_per_beat;
+double to_beat = 0;             /* frames until the next click starts */
+int next_beat = 0;              /* its beat in the bar, 0 is the downbeat */
+jack_nframes_t click_pos;       /* frames of the sounding click played */
+const sample_t *playing;
+
+/* As timebase master, the tempo map: beats since the start of bar
+   bar_offset + 1 are anchor_beat at anchor_frame, and move on at the
+   current tempo.  Tempo and meter changes move the anchor, so the
+   position is exact in fractional frames however long the transport
+   rolls.  Also process thread only; the timebase callback runs there. */
+double anchor_beat = 0;
+jack_nframes_t anchor_frame = 0;
+long bar_offset = 0;
+
+/* MIDI clock state, process thread only */
+int was_rolling = 0;
+long last_spp = -1;
 
 void
 usage ()
@@ -49,56 +95,275 @@ usage ()
         fprintf (stderr, "\n"
 "usage: jack_metro \n"
 "              [ --frequency OR -f frequency (in Hz) ]\n"
+"              [ --accent OR -F downbeat frequency (in Hz, default twice -f) ]\n"
+"              [ --meter OR -M beats per bar (default 4) ]\n"
 "              [ --amplitude OR -A maximum amplitude (between 0 and 1) ]\n"
 "              [ --duration OR -D duration (in ms) ]\n"
 "              [ --attack OR -a attack (in percent of duration) ]\n"
 "              [ --decay OR -d decay (in percent of duration) ]\n"
 "              [ --name OR -n jack name for metronome client ]\n"
 "              [ --transport OR -t transport aware ]\n"
+"              [ --timebase OR -T be timebase master (implies -t) ]\n"
 "              --bpm OR -b beats per minute\n"
+"\n"
+"While running, a line \"bpm [beats per bar]\" on stdin changes tempo and\n"
+"meter from the next period on.  With -t, tempo, meter and beat follow\n"
+"the transport's BBT position when the timebase master provides one.\n"
+"With -T this client is that master: it publishes bar, beat, tick, tempo\n"
+"and meter from its own tempo map, and stdin changes apply to it.\n"
+"The clock port sends MIDI clock at 24 per beat on the click's frame\n"
+"grid, start, stop and continue, and song position pointer.\n"
 );
 }
 
-void
-process_silence (jack_nframes_t nframes) 
+static double
+beat_at (jack_nframes_t frame)
 {
-        sample_t *buffer = (sample_t *) jack_port_get_buffer (output_port, nframes);
-        memset (buffer, 0, sizeof (jack_default_audio_sample_t) * nframes);
+        return anchor_beat + ((double) frame - (double) anchor_frame) / frames_per_beat;
 }
 
-void
-process_audio (jack_nframes_t nframes) 
+/* a tempo is playable when every click ends before the next one starts */
+static int
+tempo_ok (double new_bpm)
+{
+        const double fpb = new_bpm > 0 ? 60.0 * sr / new_bpm : 0;
+
+        return fpb >= 1 && fpb > tone_length;
+}
+
+/* change tempo keeping the fraction of the current beat already gone */
+static void
+set_tempo (double new_bpm, jack_nframes_t frame)
 {
+        const double fpb = 60.0 * sr / new_bpm;
 
-        sample_t *buffer = (sample_t *) jack_port_get_buffer (output_port, nframes);
-        jack_nframes_t frames_left = nframes;
-                
-        while (wave_length - offset < frames_left) {
-                memcpy (buffer + (nframes - frames_left), wave + offset, sizeof (sample_t) * (wave_length - offset));
-                frames_left -= wave_length - offset;
-                offset = 0;
+        if (frames_per_beat > 0) {
+                anchor_beat = beat_at (frame);
+                anchor_frame = frame;
+                to_beat *= fpb / frames_per_beat;
+        }
+        frames_per_beat = fpb;
+        bpm = new_bpm;
+}
+
+static void
+set_meter (float bpb, jack_nframes_t frame)
+{
+        const double b = beat_at (frame);
+        const double bars = floor (b / beats_per_bar);
+
+        /* the new meter counts from the start of the current bar */
+        bar_offset += bars;
+        anchor_beat = b - bars * beats_per_bar;
+        anchor_frame = frame;
+        beats_per_bar = bpb >= 1 ? (int) bpb : 1;
+        next_beat %= beats_per_bar;
+}
+
+/* line the grid up with the transport, unless it already agrees to
+   within tol beats */
+static void
+follow_transport (const jack_position_t *pos)
+{
+        double beat, have, d, tol;
+        long up;
+
+        if (timebase_master) {
+                /* our own map, rather than its rounding to ticks */
+                beat = beat_at (pos->frame);
+                tol = 0.5 / frames_per_beat;
+        } else if (pos->valid & JackPositionBBT) {
+                if (pos->beats_per_minute > 0 && pos->beats_per_minute != bpm) {
+                        set_tempo (pos->beats_per_minute, pos->frame);
+                }
+                if ((int) pos->beats_per_bar != beats_per_bar) {
+                        set_meter (pos->beats_per_bar, pos->frame);
+                }
+                /* beats into the bar at the first frame of the cycle */
+                beat = pos->beat - 1 + pos->tick / pos->ticks_per_beat;
+                if (pos->valid & JackBBTFrameOffset) {
+                        beat -= pos->bbt_offset / frames_per_beat;
+                }
+                tol = 1.0 / pos->ticks_per_beat;
+        } else {
+                beat = pos->frame / frames_per_beat;
+                tol = 0.5 / frames_per_beat;
         }
-        if (frames_left > 0) {
-                memcpy (buffer + (nframes - frames_left), wave + offset, sizeof (sample_t) * frames_left);
-                offset += frames_left;
+
+        /* where our own grid is, in the same terms */
+        have = next_beat - to_beat / frames_per_beat;
+        d = fmod (fabs (beat - have), beats_per_bar);
+        if (d <= tol || beats_per_bar - d <= tol) {
+                return;
+        }
+        up = (long) ceil (beat);
+        to_beat = (up - beat) * frames_per_beat;
+        next_beat = (up % beats_per_bar + beats_per_bar) % beats_per_bar;
+}
+
+static void
+render (sample_t *buffer, jack_nframes_t nframes)
+{
+        jack_nframes_t f = 0, n, start;
+
+        while (f < nframes) {
+                if (to_beat <= GRID_SLACK) {
+                        /* a beat falls on this frame */
+                        playing = next_beat == 0 ? accent : click;
+                        click_pos = 0;
+                        next_beat = (next_beat + 1) % beats_per_bar;
+                        to_beat += frames_per_beat;
+                }
+                start = (jack_nframes_t) ceil (to_beat - GRID_SLACK);
+                n = nframes - f < start ? nframes - f : start;
+                if (click_pos < tone_length) {
+                        if (tone_length - click_pos < n) {
+                                n = tone_length - click_pos;
+                        }
+                        memcpy (buffer + f, playing + click_pos, sizeof (sample_t) * n);
+                        click_pos += n;
+                } else {
+                        memset (buffer + f, 0, sizeof (sample_t) * n);
+                }
+                f += n;
+                to_beat -= n;
+        }
+}
+
+/* publish the position for the cycle starting at pos->frame */
+static void
+timebase (jack_transport_state_t state, jack_nframes_t nframes, jack_position_t *pos, int new_pos, void *arg)
+{
+        const double b = beat_at (pos->frame);
+        const double bars = floor (b / beats_per_bar);
+        const double in_bar = b - bars * beats_per_bar;
+
+        pos->valid = JackPositionBBT;
+        pos->bar = bar_offset + (long) bars + 1;
+        pos->beat = (int) in_bar + 1;
+        pos->tick = (in_bar - floor (in_bar)) * TICKS_PER_BEAT;
+        pos->bar_start_tick = (pos->bar - 1) * beats_per_bar * TICKS_PER_BEAT;
+        pos->beats_per_bar = beats_per_bar;
+        pos->beat_type = 4;
+        pos->ticks_per_beat = TICKS_PER_BEAT;
+        pos->beats_per_minute = bpm;
+}
+
+/* song position at the first frame of the cycle, in beats */
+static double
+song_beats (const jack_position_t *pos)
+{
+        if (timebase_master) {
+                return bar_offset * beats_per_bar + beat_at (pos->frame);
+        } else if (pos->valid & JackPositionBBT) {
+                return (pos->bar - 1) * pos->beats_per_bar + pos->beat - 1 + pos->tick / pos->ticks_per_beat;
+        }
+        return pos->frame / frames_per_beat;
+}
+
+/* song position pointer, in sixteenths; returns the value sent */
+static long
+send_spp (void *midi, const jack_position_t *pos)
+{
+        long spp = (long) floor (song_beats (pos) * 4 + GRID_SLACK);
+        jack_midi_data_t m[3];
+
+        spp = spp < 0 ? 0 : spp > 0x3fff ? 0x3fff : spp;
+        m[0] = MIDI_SPP;
+        m[1] = spp & 0x7f;
+        m[2] = spp >> 7;
+        jack_midi_event_write (midi, 0, m, 3);
+        return spp;
+}
+
+/* clock pulses on the click's grid: pulse p is at beat p / CLOCK_PPQN,
+   placed on the same frame a click there would start on */
+static void
+send_clock (void *midi, jack_nframes_t nframes)
+{
+        static const jack_midi_data_t tick = MIDI_CLOCK;
+        const double have = next_beat - to_beat / frames_per_beat;
+        /* the first pulse that rounds up to this cycle: a pulse up to a
+           frame before its start went out on this cycle's frame 0 */
+        double p = floor ((have - (1 - GRID_SLACK) / frames_per_beat) * CLOCK_PPQN) + 1;
+        double at;
+
+        for (;;) {
+                at = ceil ((p / CLOCK_PPQN - have) * frames_per_beat - GRID_SLACK);
+                if (at >= nframes) {
+                        break;
+                }
+                jack_midi_event_write (midi, at > 0 ? (jack_nframes_t) at : 0, &tick, 1);
+                p++;
         }
 }
 
 int
 process (jack_nframes_t nframes, void *arg)
 {
+  const uint64_t t0 = dspstat_begin ();
+  sample_t *buffer = (sample_t *) jack_port_get_buffer (output_port, nframes);
+  void *midi = jack_port_get_buffer (clock_port, nframes);
+  static const jack_midi_data_t start = MIDI_START, cont = MIDI_CONTINUE, stop = MIDI_STOP;
+  jack_transport_state_t state = JackTransportRolling;
+  jack_position_t pos;
+  tempo_msg m;
+
   if (transport_aware) {
-    jack_position_t pos;
-    if (jack_transport_query (client, &pos) != JackTransportRolling) {
-      process_silence (nframes);
-      return 0;
+    state = jack_transport_query (client, &pos);
+  } else {
+    pos.frame = 0;
+    pos.valid = 0;
+    }
+  jack_midi_clear_buffer (midi);
+
+  while (jack_ringbuffer_read_space (tempo_rb) >= sizeof (m)) {
+    jack_ringbuffer_read (tempo_rb, (char *) &m, sizeof (m));
+    if (m.bpm > 0) {
+      set_tempo (m.bpm, pos.frame);
+      }
+    if (m.beats_per_bar > 0) {
+      set_meter (m.beats_per_bar, pos.frame);
+      }
+    }
+
+  if (state != JackTransportRolling) {
+    memset (buffer, 0, sizeof (sample_t) * nframes);
+    click_pos = tone_length;
+    if (was_rolling) {
+      jack_midi_event_write (midi, 0, &stop, 1);
+      was_rolling = 0;
+      last_spp = -1;
       }
-    offset = pos.frame % wave_length;
+    /* keep followers cued to wherever the transport is located */
+    if ((long) floor (song_beats (&pos) * 4 + GRID_SLACK) != last_spp) {
+      last_spp = send_spp (midi, &pos);
+      }
+  } else {
+    if (transport_aware) {
+      follow_transport (&pos);
+      }
+    if (!was_rolling) {
+      if (send_spp (midi, &pos) == 0) {
+        jack_midi_event_write (midi, 0, &start, 1);
+      } else {
+        jack_midi_event_write (midi, 0, &cont, 1);
+        }
+      was_rolling = 1;
+      }
+    send_clock (midi, nframes);
+    render (buffer, nframes);
     }
-  process_audio (nframes);
+  dspstat_end (t0, nframes);
   return 0;
 }
 
+static void
+wearedone (int sig)
+{
+        keeprunning = 0;
+}
+
 int
 sample_rate_change () {
         printf("Sample rate has changed! Exiting...\n");
@@ -109,7 +374,7 @@ int
 main (int argc, char *argv[])
 {
         
-        sample_t scale;
+        double scale;
         int i, attack_length, decay_length;
         double *amp;
         double max_amp = 0.5;
@@ -119,12 +384,16 @@ main (int argc, char *argv[])
         int attack_percent = 1, decay_percent = 10, dur_arg = 100;
         char *client_name = 0;
         char *bpm_string = "bpm";
+        char line[256];
         int verbose = 0;
+        struct sigaction sa;
 
-        const char *options = "f:A:D:a:d:b:n:thv";
+        const char *options = "f:F:M:A:D:a:d:b:n:tThv";
         struct option long_options[] =
         {
                 {"frequency", 1, 0, 'f'},
+                {"accent", 1, 0, 'F'},
+                {"meter", 1, 0, 'M'},
                 {"amplitude", 1, 0, 'A'},
                 {"duration", 1, 0, 'D'},
                 {"attack", 1, 0, 'a'},
@@ -132,6 +401,7 @@ main (int argc, char *argv[])
                 {"bpm", 1, 0, 'b'},
                 {"name", 1, 0, 'n'},
                 {"transport", 0, 0, 't'},
+                {"timebase", 0, 0, 'T'},
                 {"help", 0, 0, 'h'},
                 {"verbose", 0, 0, 'v'},
                 {0, 0, 0, 0}
@@ -145,6 +415,18 @@ main (int argc, char *argv[])
                                 return -1;
                         }
                         break;
+                case 'F':
+                        if ((accent_freq = atoi (optarg)) <= 0) {
+                                fprintf (stderr, "invalid accent frequency\n");
+                                return -1;
+                        }
+                        break;
+                case 'M':
+                        if ((beats_per_bar = atoi (optarg)) < 1) {
+                                fprintf (stderr, "invalid meter\n");
+                                return -1;
+                        }
+                        break;
                 case 'A':
                         if (((max_amp = atof (optarg)) <= 0)|| (max_amp > 1)) {
                                 fprintf (stderr, "invalid amplitude\n");
@@ -169,16 +451,16 @@ main (int argc, char *argv[])
                         break;
                 case 'b':
                         got_bpm = 1;
-                        if ((bpm = atoi (optarg)) < 0) {
+                        if ((bpm = atof (optarg)) <= 0) {
                                 fprintf (stderr, "invalid bpm\n");
                                 return -1;
                         }
-                        bpm_string = (char *) malloc ((strlen (optarg) + 4) * sizeof (char));
+                        bpm_string = (char *) malloc ((strlen (optarg) + 5) * sizeof (char));
                         strcpy (bpm_string, optarg);
                         strcat (bpm_string, "_bpm");
                         break;
                 case 'n':
-                        client_name = (char *) malloc (strlen (optarg) * sizeof (char));
+                        client_name = (char *) malloc ((strlen (optarg) + 1) * sizeof (char));
                         strcpy (client_name, optarg);
                         break;
                 case 'v':
@@ -187,6 +469,10 @@ main (int argc, char *argv[])
                 case 't':
                         transport_aware = 1;
                         break;
+                case 'T':
+                        timebase_master = 1;
+                        transport_aware = 1;
+                        break;
                 default:
                         fprintf (stderr, "unknown option %c\n", opt); 
                 case 'h':
@@ -199,6 +485,9 @@ main (int argc, char *argv[])
                 usage ();
                 return -1;
         }
+        if (!accent_freq) {
+                accent_freq = 2 * freq;
+        }
 
         /* Initial Jack setup, get sample rate */
         if (!client_name) {
@@ -211,20 +500,25 @@ main (int argc, char *argv[])
         }
         jack_set_process_callback (client, process, 0);
         output_port = jack_port_register (client, bpm_string, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+        clock_port = jack_port_register (client, "clock", JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
 
         sr = jack_get_sample_rate (client);
 
-        /* setup wave table parameters */
-        wave_length = 60 * sr / bpm;
+        dspstat_init (client, client_name);
+        /* removes the report socket however main() ends */
+        atexit (dspstat_close);
+
+        /* setup click parameters */
+        set_tempo (bpm, 0);
         tone_length = sr * dur_arg / 1000;
         attack_length = tone_length * attack_percent / 100;
         decay_length = tone_length * decay_percent / 100;
-        scale = 2 * PI * freq / sr;
+        click_pos = tone_length;
 
-        if (tone_length >= wave_length) {
+        if (!tempo_ok (bpm)) {
                 fprintf (stderr, "invalid duration (tone length = %" PRIu32
-                         ", wave length = %" PRIu32 "\n", tone_length,
-                         wave_length);
+                         ", beat length = %.1f\n", tone_length,
+                         frames_per_beat);
                 return -1;
         }
         if (attack_length + decay_length > (int)tone_length) {
@@ -232,8 +526,9 @@ main (int argc, char *argv[])
                 return -1;
         }
 
-        /* Build the wave table */
-        wave = (sample_t *) malloc (wave_length * sizeof(sample_t));
+        /* Build the clicks: only the tone, the silence is counted */
+        click = (sample_t *) malloc (tone_length * sizeof(sample_t));
+        accent = (sample_t *) malloc (tone_length * sizeof(sample_t));
         amp = (double *) malloc (tone_length * sizeof(double));
 
         for (i = 0; i < attack_length; i++) {
@@ -245,11 +540,21 @@ main (int argc, char *argv[])
         for (i = (int)tone_length - decay_length; i < (int)tone_length; i++) {
                 amp[i] = - max_amp * (i - (double) tone_length) / ((double) decay_length);
         }
+        scale = 2 * M_PI * freq / sr;
+        for (i = 0; i < (int)tone_length; i++) {
+                click[i] = amp[i] * sin (scale * i);
+        }
+        scale = 2 * M_PI * accent_freq / sr;
         for (i = 0; i < (int)tone_length; i++) {
-                wave[i] = amp[i] * sin (scale * i);
+                accent[i] = amp[i] * sin (scale * i);
         }
-        for (i = tone_length; i < (int)wave_length; i++) {
-                wave[i] = 0;
+        free (amp);
+
+        tempo_rb = jack_ringbuffer_create (TEMPO_QUEUE * sizeof (tempo_msg));
+
+        if (timebase_master && jack_set_timebase_callback (client, 0, timebase, 0)) {
+                fprintf (stderr, "cannot become timebase master\n");
+                return 1;
         }
 
         if (jack_activate (client)) {
@@ -257,11 +562,39 @@ main (int argc, char *argv[])
                 return 1;
         }
 
-        while (1) {
-                sleep(1);
-        };
-        
-}
+        /* no SA_RESTART, so a signal also breaks the wait for stdin */
+        memset (&sa, 0, sizeof (sa));
+        sa.sa_handler = wearedone;
+        sigaction (SIGHUP, &sa, NULL);
+        sigaction (SIGINT, &sa, NULL);
+        sigaction (SIGTERM, &sa, NULL);
 
+        /* tempo changes, one "bpm [beats per bar]" per line */
+        while (keeprunning && fgets (line, sizeof (line), stdin)) {
+                tempo_msg m = { 0, 0 };
 
+                if (sscanf (line, "%lf %f", &m.bpm, &m.beats_per_bar) < 1) {
+                        fprintf (stderr, "expected: bpm [beats per bar]\n");
+                        continue;
+                }
+                if (!tempo_ok (m.bpm)) {
+                        fprintf (stderr, "invalid tempo (tone length = %" PRIu32
+                                 ", beat length = %.1f)\n", tone_length,
+                                 60.0 * sr / m.bpm);
+                        continue;
+                }
+                if (jack_ringbuffer_write_space (tempo_rb) >= sizeof (m)) {
+                        jack_ringbuffer_write (tempo_rb, (char *) &m, sizeof (m));
+                }
+                if (verbose) {
+                        printf ("tempo %g bpm\n", m.bpm);
+                }
+        }
 
+        while (keeprunning) {
+                sleep(1);
+        };
+
+        jack_client_close (client);
+        return 0;
+}
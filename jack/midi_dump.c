@@ -9,6 +9,8 @@
 #include <jack/midiport.h>
 #include <jack/ringbuffer.h>
 
+#include "dspstat.h"
+
 #ifdef __MINGW32__
 #include <pthread.h>
 #endif
@@ -71,6 +73,7 @@ describe (midimsg* event)
 int
 process (jack_nframes_t frames, void* arg)
 {
+	const uint64_t t0 = dspstat_begin ();
 	void* buffer;
 	jack_nframes_t N;
 	jack_nframes_t i;
@@ -85,7 +88,9 @@ process (jack_nframes_t frames, void* arg)
 
 		r = jack_midi_event_get (&event, buffer, i);
 
-		if (r == 0 && jack_ringbuffer_write_space (rb) >= sizeof(midimsg)) {
+		if (r == 0 && jack_ringbuffer_write_space (rb) < sizeof(midimsg)) {
+			dspstat_dropped (1);
+		} else if (r == 0) {
 			midimsg m;
 			m.tme_mon = monotonic_cnt;
 			m.tme_rel = event.time;
@@ -103,6 +108,7 @@ process (jack_nframes_t frames, void* arg)
 		pthread_mutex_unlock (&msg_thread_lock);
 	}
 
+	dspstat_end (t0, frames);
 	return 0;
 }
 
@@ -161,6 +167,8 @@ main (int argc, char* argv[])
 
 	rb = jack_ringbuffer_create (RBSIZE * sizeof(midimsg));
 
+	dspstat_init (client, client_name);
+
 	jack_set_process_callback (client, process, 0);
 
 	port = jack_port_register (client, "input", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
@@ -222,6 +230,7 @@ main (int argc, char* argv[])
 	pthread_mutex_unlock (&msg_thread_lock);
 
 	jack_deactivate (client);
+	dspstat_close ();
 	jack_client_close (client);
 	jack_ringbuffer_free (rb);
 
@@ -0,0 +1,386 @@
+/*
+ * MIDI round trip latency and jitter.
+ *
+ * Probes leave "probe_out" at known frames and are timed when they come
+ * back on "probe_in".  A probe is a note off on one channel with a 14
+ * bit sequence number in its two data bytes, so it passes anything that
+ * routes channel messages -- alsa/amidimux included -- and sounds
+ * nothing if it reaches a synth.  The process callback only writes
+ * probes and notes when each left and came back, into a
+ * jack_ringbuffer_t as midi_dump does; the main thread pairs them up,
+ * counts the ones lost, and prints the spread and a histogram in frames
+ * and microseconds when done.
+ *
+ * With no ports given the output is wired straight to the input, one
+ * period round the graph.  To go through amidimux under a2jmidid, send
+ * to its Input and take back its "MIDI Channel 15" (channel 16 is the
+ * default).
+ *
+ * Times are jack_last_frame_time() plus the event offset, compared
+ * modulo 2^32, so the run may cross the frame counter's wrap.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <inttypes.h>
+#include <jack/jack.h>
+#include <jack/midiport.h>
+#include <jack/ringbuffer.h>
+
+#include "dspstat.h"
+
+#ifndef WIN32
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
+#define SEQS (16384)        /* sequence numbers, 14 bits */
+#define RBSIZE (4096)       /* probe records in the ring */
+#define HIST_ROWS (24)
+#define HIST_BAR (50)
+
+typedef struct {
+  uint8_t back;           /* 0 when sent, 1 when it came back */
+  uint16_t seq;
+  jack_nframes_t frame;
+  } probe;
+
+static jack_client_t *client;
+static jack_port_t *output_port, *input_port;
+static jack_ringbuffer_t *rb = NULL;
+static pthread_mutex_t msg_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t data_ready = PTHREAD_COND_INITIALIZER;
+
+static int keeprunning = 1;
+static int channel = 15;
+static jack_nframes_t interval;
+static unsigned long count = 0;   /* probes to send, 0 for no limit */
+
+/* RT thread only */
+static int started = 0;
+static jack_nframes_t next_probe;
+static unsigned long sent = 0;
+
+static void record (int back, uint16_t seq, jack_nframes_t frame)
+{
+  probe p;
+
+  if (jack_ringbuffer_write_space (rb) < sizeof (p)) {
+    dspstat_dropped (1);
+    return;
+    }
+  p.back = back;
+  p.seq = seq;
+  p.frame = frame;
+  jack_ringbuffer_write (rb, (const char *) &p, sizeof (p));
+}
+
+int
+process (jack_nframes_t nframes, void *arg)
+{
+  const uint64_t t0 = dspstat_begin ();
+  const jack_nframes_t now = jack_last_frame_time (client);
+  void *out = jack_port_get_buffer (output_port, nframes);
+  void *in = jack_port_get_buffer (input_port, nframes);
+  jack_midi_event_t ev;
+  jack_midi_data_t msg[3];
+  uint32_t i, n;
+
+  n = jack_midi_get_event_count (in);
+  for (i=0; i<n; i++) {
+    if (jack_midi_event_get (&ev, in, i) == 0 && ev.size == 3
+        && (ev.buffer[0] & 0xef) == (0x80 | channel)) {
+      record (1, ev.buffer[1] | (ev.buffer[2] << 7), now + ev.time);
+      }
+    }
+
+  jack_midi_clear_buffer (out);
+  if (!started) {
+    next_probe = now;
+    started = 1;
+    }
+  /* after an xrun, skip the probes whose time has gone */
+  while ((int32_t) (next_probe - now) < 0) {
+    next_probe += interval;
+    }
+  while (next_probe - now < nframes && (count == 0 || sent < count)) {
+    msg[0] = 0x80 | channel;
+    msg[1] = sent & 0x7f;
+    msg[2] = (sent >> 7) & 0x7f;
+    if (jack_midi_event_write (out, next_probe - now, msg, 3) == 0) {
+      record (0, sent % SEQS, next_probe);
+      sent++;
+      }
+    next_probe += interval;
+    }
+
+  if (pthread_mutex_trylock (&msg_thread_lock) == 0) {
+    pthread_cond_signal (&data_ready);
+    pthread_mutex_unlock (&msg_thread_lock);
+    }
+
+  dspstat_end (t0, nframes);
+  return 0;
+}
+
+/* ---- pairing and statistics, on the main thread ---- */
+
+static jack_nframes_t sent_at[SEQS];
+static uint8_t in_flight[SEQS];
+static jack_nframes_t *lat = NULL;
+static size_t nlat = 0, lat_cap = 0;
+static unsigned long resolved = 0, lost = 0, stray = 0;
+
+static void returned (jack_nframes_t l)
+{
+  if (nlat == lat_cap) {
+    lat_cap = lat_cap ? 2 * lat_cap : 1024;
+    lat = realloc (lat, lat_cap * sizeof (jack_nframes_t));
+    }
+  lat[nlat++] = l;
+}
+
+static void drain (unsigned long sr, jack_nframes_t timeout, int verbose)
+{
+  const jack_nframes_t now = jack_frame_time (client);
+  probe p;
+  int s;
+
+  while (jack_ringbuffer_read (rb, (char *) &p, sizeof (p)) == sizeof (p)) {
+    if (!p.back) {
+      if (in_flight[p.seq]) {
+        lost++;
+        resolved++;
+        }
+      sent_at[p.seq] = p.frame;
+      in_flight[p.seq] = 1;
+    } else if (in_flight[p.seq]) {
+      in_flight[p.seq] = 0;
+      returned (p.frame - sent_at[p.seq]);
+      resolved++;
+      if (verbose) {
+        printf ("probe %5u: %6u frames %9.1f us\n", p.seq, p.frame - sent_at[p.seq],
+                (p.frame - sent_at[p.seq]) * 1e6 / sr);
+        }
+    } else {
+      stray++;
+      }
+    }
+
+  for (s=0; s<SEQS; s++) {
+    if (in_flight[s] && (int32_t) (now - sent_at[s]) > (int32_t) timeout) {
+      in_flight[s] = 0;
+      lost++;
+      resolved++;
+      }
+    }
+  fflush (stdout);
+}
+
+static int cmp_frames (const void *a, const void *b)
+{
+  const jack_nframes_t x = *(const jack_nframes_t *) a, y = *(const jack_nframes_t *) b;
+
+  return x < y ? -1 : (x > y);
+}
+
+static void report (unsigned long sr, jack_nframes_t period, jack_nframes_t bin)
+{
+  double sum = 0, ss = 0, mean;
+  jack_nframes_t lo, hi, b;
+  size_t k, most = 0, rows, row, *hist;
+
+  printf ("%lu probes sent, %zu came back, %lu lost, %lu stray\n", sent, nlat, lost, stray);
+  if (nlat == 0) {
+    return;
+    }
+  qsort (lat, nlat, sizeof (jack_nframes_t), cmp_frames);
+  for (k=0; k<nlat; k++) {
+    sum += lat[k];
+    }
+  mean = sum / nlat;
+  for (k=0; k<nlat; k++) {
+    ss += (lat[k] - mean) * (lat[k] - mean);
+    }
+  lo = lat[0];
+  hi = lat[nlat - 1];
+  printf ("latency (frames): min %u p50 %u p99 %u max %u mean %.2f (%.2f periods), jitter %u peak to peak, %.2f rms\n",
+          lo, lat[nlat / 2], lat[nlat * 99 / 100], hi, mean, mean / period, hi - lo, sqrt (ss / nlat));
+  printf ("latency (us):     min %.1f p50 %.1f p99 %.1f max %.1f mean %.1f, jitter %.1f peak to peak, %.1f rms\n",
+          lo * 1e6 / sr, lat[nlat / 2] * 1e6 / sr, lat[nlat * 99 / 100] * 1e6 / sr, hi * 1e6 / sr,
+          mean * 1e6 / sr, (hi - lo) * 1e6 / sr, sqrt (ss / nlat) * 1e6 / sr);
+
+  b = bin ? bin : (hi - lo) / HIST_ROWS + 1;
+  rows = (hi - lo) / b + 1;
+  hist = calloc (rows, sizeof (size_t));
+  for (k=0; k<nlat; k++) {
+    row = (lat[k] - lo) / b;
+    if (++hist[row] > most) {
+      most = hist[row];
+      }
+    }
+  printf ("%10s %10s %8s\n", "frames", "us", "probes");
+  for (row=0; row<rows; row++) {
+    printf ("%10u %10.1f %8zu ", lo + (jack_nframes_t) row * b, (lo + row * b) * 1e6 / sr, hist[row]);
+    for (k=0; k<(hist[row] * HIST_BAR + most - 1) / most; k++) {
+      putchar ('#');
+      }
+    putchar ('\n');
+    }
+  free (hist);
+}
+
+static void wearedone (int sig)
+{
+  keeprunning = 0;
+}
+
+static void usage (int status)
+{
+  printf ("usage: midilat [ -c count ] [ -t ms ] [ -C channel ] [ -w ms ] [ -b frames ] [ -v ] [ -n name ] [ -o port -i port ]\n"
+"  -c     send this many probes, then report (default: until interrupted)\n"
+"  -t     time between probes in ms (default 100), made an odd number of\n"
+"         frames so the probes land at every offset in the period in turn\n"
+"  -C     MIDI channel of the probes, 1-16 (default 16)\n"
+"  -w     a probe not back within this many ms is lost (default 1000)\n"
+"  -b     histogram bin in frames (default: about %d rows)\n"
+"  -v     print every probe as it comes back\n"
+"  -n     client name (default midilat)\n"
+"  -o -i  where the probes go and where they come back from; without\n"
+"         them probe_out is wired straight to probe_in\n", HIST_ROWS);
+  exit (status);
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *client_name = "midilat";
+  const char *dest = NULL, *source = NULL;
+  double ms = 100, wait_ms = 1000;
+  jack_nframes_t bin = 0, period, timeout;
+  unsigned long sr;
+  int opt, verbose = 0;
+
+  while ((opt = getopt (argc, argv, "c:t:C:w:b:vn:o:i:h")) != -1) {
+    switch (opt) {
+      case 'c':
+        count = atol (optarg);
+        break;
+      case 't':
+        ms = atof (optarg);
+        break;
+      case 'C':
+        channel = atoi (optarg) - 1;
+        break;
+      case 'w':
+        wait_ms = atof (optarg);
+        break;
+      case 'b':
+        bin = atoi (optarg);
+        break;
+      case 'v':
+        verbose = 1;
+        break;
+      case 'n':
+        client_name = optarg;
+        break;
+      case 'o':
+        dest = optarg;
+        break;
+      case 'i':
+        source = optarg;
+        break;
+      case 'h':
+        usage (EXIT_SUCCESS);
+      default:
+        usage (EXIT_FAILURE);
+      }
+    }
+  if (ms <= 0 || wait_ms <= 0 || channel < 0 || channel > 15 || (dest == NULL) != (source == NULL)) {
+    usage (EXIT_FAILURE);
+    }
+
+  client = jack_client_open (client_name, JackNullOption, NULL);
+  if (client == NULL) {
+    fprintf (stderr, "Could not create JACK client.\n");
+    exit (EXIT_FAILURE);
+    }
+  sr = jack_get_sample_rate (client);
+  period = jack_get_buffer_size (client);
+  interval = (jack_nframes_t) (ms * sr / 1000) | 1;
+  timeout = wait_ms * sr / 1000;
+
+  rb = jack_ringbuffer_create (RBSIZE * sizeof (probe));
+  if (rb == NULL) {
+    fprintf (stderr, "Could not allocate the ringbuffer.\n");
+    exit (EXIT_FAILURE);
+    }
+  jack_ringbuffer_mlock (rb);
+
+  dspstat_init (client, client_name);
+
+  jack_set_process_callback (client, process, 0);
+
+  output_port = jack_port_register (client, "probe_out", JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
+  input_port = jack_port_register (client, "probe_in", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+  if (output_port == NULL || input_port == NULL) {
+    fprintf (stderr, "Could not register port.\n");
+    exit (EXIT_FAILURE);
+    }
+
+  printf ("probing every %u frames on channel %d at %lu Hz, period %u\n", interval, channel + 1, sr, period);
+  fflush (stdout);
+
+#ifndef WIN32
+  if (mlockall (MCL_CURRENT | MCL_FUTURE)) {
+    fprintf (stderr, "Warning: Can not lock memory.\n");
+    }
+#endif
+
+  if (jack_activate (client)) {
+    fprintf (stderr, "Could not activate client.\n");
+    exit (EXIT_FAILURE);
+    }
+
+  if (dest == NULL) {
+    if (jack_connect (client, jack_port_name (output_port), jack_port_name (input_port))) {
+      fprintf (stderr, "cannot connect probe_out to probe_in\n");
+      }
+  } else {
+    if (jack_connect (client, jack_port_name (output_port), dest)) {
+      fprintf (stderr, "cannot connect \"%s\"\n", dest);
+      }
+    if (jack_connect (client, source, jack_port_name (input_port))) {
+      fprintf (stderr, "cannot connect \"%s\"\n", source);
+      }
+    }
+
+#ifndef WIN32
+  signal (SIGHUP, wearedone);
+  signal (SIGINT, wearedone);
+#endif
+
+  pthread_mutex_lock (&msg_thread_lock);
+  while (keeprunning && !(count && resolved == count)) {
+    pthread_cond_wait (&data_ready, &msg_thread_lock);
+    pthread_mutex_unlock (&msg_thread_lock);
+    drain (sr, timeout, verbose);
+    pthread_mutex_lock (&msg_thread_lock);
+    }
+  pthread_mutex_unlock (&msg_thread_lock);
+
+  jack_deactivate (client);
+  drain (sr, timeout, verbose);
+  report (sr, period, bin);
+
+  dspstat_close ();
+  jack_client_close (client);
+  jack_ringbuffer_free (rb);
+  free (lat);
+
+  return nlat && !lost ? EXIT_SUCCESS : EXIT_FAILURE;
+}
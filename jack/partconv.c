@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fft.h"
+#include "partconv.h"
+
+struct partconv {
+  int block, nbins, parts;
+  int head;             /* newest spectrum in the delay line */
+  fft *fft;
+  float *hr, *hi;       /* IR partition spectra, [part * nbins + bin] */
+  float *xr, *xi;       /* input spectra, ring indexed by head */
+  float *ar, *ai;       /* accumulated output spectrum */
+  float *in;            /* last two blocks of input */
+  float *out;           /* inverse transform */
+  };
+
+static float *falloc (size_t n)
+{
+  void *p;
+
+  if (posix_memalign (&p, 32, n * sizeof (float))) {
+    return NULL;
+    }
+  memset (p, 0, n * sizeof (float));
+  return p;
+}
+
+partconv *partconv_create (const float *ir, size_t len, int block)
+{
+  partconv *pc;
+  float *seg;
+  int p;
+
+  if ((pc = calloc (1, sizeof (partconv))) == NULL) {
+    return NULL;
+    }
+  pc->block = block;
+  pc->nbins = block + 1;
+  pc->parts = len ? (len + block - 1) / block : 1;
+  pc->fft = fft_create (2 * block);
+  pc->hr = falloc ((size_t) pc->parts * pc->nbins);
+  pc->hi = falloc ((size_t) pc->parts * pc->nbins);
+  pc->xr = falloc ((size_t) pc->parts * pc->nbins);
+  pc->xi = falloc ((size_t) pc->parts * pc->nbins);
+  pc->ar = falloc (pc->nbins);
+  pc->ai = falloc (pc->nbins);
+  pc->in = falloc (2 * block);
+  pc->out = falloc (2 * block);
+  seg = falloc (2 * block);
+  if (!pc->fft || !pc->hr || !pc->hi || !pc->xr || !pc->xi || !pc->ar || !pc->ai || !pc->in || !pc->out || !seg) {
+    free (seg);
+    partconv_free (pc);
+    return NULL;
+    }
+
+  /* each partition zero padded to two blocks; the 1/n of the inverse
+     transform is folded in here */
+  for (p=0; p<pc->parts; p++) {
+    const size_t off = (size_t) p * block;
+    const size_t n = len - off < (size_t) block ? len - off : (size_t) block;
+    size_t i;
+
+    memset (seg, 0, 2 * block * sizeof (float));
+    for (i=0; i<n && off < len; i++) {
+      seg[i] = ir[off + i] / (2 * block);
+      }
+    fft_forward (pc->fft, seg, pc->hr + (size_t) p * pc->nbins, pc->hi + (size_t) p * pc->nbins);
+    }
+  free (seg);
+  return pc;
+}
+
+void partconv_free (partconv *pc)
+{
+  if (pc) {
+    fft_free (pc->fft);
+    free (pc->hr);
+    free (pc->hi);
+    free (pc->xr);
+    free (pc->xi);
+    free (pc->ar);
+    free (pc->ai);
+    free (pc->in);
+    free (pc->out);
+    free (pc);
+    }
+}
+
+int partconv_block (const partconv *pc)
+{
+  return pc->block;
+}
+
+int partconv_partitions (const partconv *pc)
+{
+  return pc->parts;
+}
+
+/* a += x * h over one partition's bins */
+static void cmac (float *restrict ar, float *restrict ai, const float *restrict xr, const float *restrict xi,
+                  const float *restrict hr, const float *restrict hi, int n)
+{
+  int k;
+
+  for (k=0; k<n; k++) {
+    ar[k] += xr[k] * hr[k] - xi[k] * hi[k];
+    ai[k] += xr[k] * hi[k] + xi[k] * hr[k];
+    }
+}
+
+void partconv_process (partconv *pc, const float *in, float *out)
+{
+  const int B = pc->block, nb = pc->nbins;
+  int p, x;
+
+  /* slide the input window and transform it into the delay line */
+  memcpy (pc->in, pc->in + B, B * sizeof (float));
+  memcpy (pc->in + B, in, B * sizeof (float));
+  fft_forward (pc->fft, pc->in, pc->xr + (size_t) pc->head * nb, pc->xi + (size_t) pc->head * nb);
+
+  /* partition p meets the input from p blocks ago */
+  memset (pc->ar, 0, nb * sizeof (float));
+  memset (pc->ai, 0, nb * sizeof (float));
+  for (p=0, x=pc->head; p<pc->parts; p++) {
+    cmac (pc->ar, pc->ai, pc->xr + (size_t) x * nb, pc->xi + (size_t) x * nb,
+          pc->hr + (size_t) p * nb, pc->hi + (size_t) p * nb, nb);
+    x = x ? x - 1 : pc->parts - 1;
+    }
+
+  /* overlap-save: the second half is the linear convolution */
+  fft_inverse (pc->fft, pc->ar, pc->ai, pc->out);
+  memcpy (out, pc->out + B, B * sizeof (float));
+
+  pc->head = pc->head + 1 < pc->parts ? pc->head + 1 : 0;
+}
@@ -0,0 +1,28 @@
+/*
+ * Uniformly partitioned FFT convolution (overlap-save with a frequency
+ * domain delay line).  The impulse response is cut into partitions of
+ * one block each and transformed once by partconv_create(); each block
+ * of input then costs one forward and one inverse FFT of twice the
+ * block plus a multiply-accumulate over every partition, so the work
+ * per block is bounded and proportional to the IR length.
+ */
+
+#ifndef PARTCONV_H
+#define PARTCONV_H
+
+#include <stddef.h>
+
+typedef struct partconv partconv;
+
+/* block is a power of two; NULL if out of memory.  Allocates and
+   transforms everything, so keep it off the RT thread. */
+partconv *partconv_create (const float *ir, size_t len, int block);
+void partconv_free (partconv *pc);
+
+/* convolve exactly one block: out may be the same buffer as in */
+void partconv_process (partconv *pc, const float *in, float *out);
+
+int partconv_block (const partconv *pc);
+int partconv_partitions (const partconv *pc);
+
+#endif
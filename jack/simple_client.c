@@ -9,9 +9,12 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
 
 #include <jack/jack.h>
 
+#include "dspstat.h"
+
 jack_port_t *input_port;
 jack_port_t *output_port;
 
@@ -22,11 +25,13 @@ jack_port_t *output_port;
 int
 process (jack_nframes_t nframes, void *arg)
 {
+        const uint64_t t0 = dspstat_begin ();
         jack_default_audio_sample_t *out = (jack_default_audio_sample_t *) jack_port_get_buffer (output_port, nframes);
         jack_default_audio_sample_t *in = (jack_default_audio_sample_t *) jack_port_get_buffer (input_port, nframes);
 
         memcpy (out, in, sizeof (jack_default_audio_sample_t) * nframes);
-        
+
+        dspstat_end (t0, nframes);
         return 0;      
 }
 
@@ -42,6 +47,14 @@ jack_shutdown (void *arg)
         exit (1);
 }
 
+static volatile sig_atomic_t keeprunning = 1;
+
+static void
+wearedone (int sig)
+{
+        keeprunning = 0;
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -73,6 +86,9 @@ main (int argc, char *argv[])
 
         jack_on_shutdown (client, jack_shutdown, 0);
 
+        dspstat_init (client, "simple_client");
+        atexit (dspstat_close);
+
         /* display the current sample rate. 
          */
 
@@ -91,6 +107,10 @@ main (int argc, char *argv[])
                 return 1;
         }
 
+        signal (SIGHUP, wearedone);
+        signal (SIGINT, wearedone);
+        signal (SIGTERM, wearedone);
+
         /* connect the ports. Note: you can't do this before
            the client is activated, because we can't allow
            connections to be made to clients that aren't
@@ -121,7 +141,9 @@ main (int argc, char *argv[])
 
         /* Since this is just a toy, run for a few seconds, then finish */
 
-        sleep (10);
+        if (keeprunning) {
+                sleep (10);
+        }
         jack_client_close (client);
         exit (0);
 }
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "smf.h"
+
+typedef struct {
+  uint64_t tick;
+  uint32_t seq;     /* file order, keeps same-tick events stable */
+  uint32_t tempo;   /* usec per quarter note for tempo events, else 0 */
+  uint8_t  size;
+  uint8_t  data[3];
+  } rawevent;
+
+typedef struct {
+  rawevent *ev;
+  size_t count, alloc;
+  } rawlist;
+
+static uint32_t be (const uint8_t *p, int n)
+{
+  uint32_t v = 0;
+
+  while (n--) {
+    v = (v << 8) | *p++;
+    }
+  return v;
+}
+
+/* variable length quantity; returns -1 on running off the end */
+static int vlq (const uint8_t **p, const uint8_t *end, uint32_t *v)
+{
+  int i;
+
+  *v = 0;
+  for (i=0; i<4 && *p < end; i++) {
+    *v = (*v << 7) | (**p & 0x7f);
+    if (!(*(*p)++ & 0x80)) {
+      return 0;
+      }
+    }
+  return -1;
+}
+
+static rawevent *push (rawlist *l)
+{
+  if (l->count == l->alloc) {
+    rawevent *n;
+    l->alloc = l->alloc ? 2 * l->alloc : 1024;
+    if ((n = realloc (l->ev, l->alloc * sizeof (rawevent))) == NULL) {
+      return NULL;
+      }
+    l->ev = n;
+    }
+  memset (&l->ev[l->count], 0, sizeof (rawevent));
+  l->ev[l->count].seq = l->count;
+  return &l->ev[l->count++];
+}
+
+static int parse_track (rawlist *l, const uint8_t *p, const uint8_t *end)
+{
+  uint64_t tick = 0;
+  uint8_t status = 0;
+  uint32_t delta, len;
+  rawevent *e;
+
+  while (p < end) {
+    if (vlq (&p, end, &delta) || p >= end) {
+      return -1;
+      }
+    tick += delta;
+
+    if (*p == 0xff) {
+      if (p + 2 > end) {
+        return -1;
+        }
+      uint8_t type = p[1];
+      p += 2;
+      if (vlq (&p, end, &len) || p + len > end) {
+        return -1;
+        }
+      if (type == 0x51 && len == 3) {
+        if ((e = push (l)) == NULL) {
+          return -1;
+          }
+        e->tick = tick;
+        e->tempo = be (p, 3);
+        }
+      p += len;
+      if (type == 0x2f) {
+        break;
+        }
+      continue;
+      }
+
+    if (*p == 0xf0 || *p == 0xf7) {
+      p++;
+      if (vlq (&p, end, &len) || p + len > end) {
+        return -1;
+        }
+      p += len;
+      status = 0;
+      continue;
+      }
+
+    if (*p & 0x80) {
+      status = *p++;
+    } else if (status == 0) {
+      return -1;
+      }
+
+    len = ((status & 0xf0) == 0xc0 || (status & 0xf0) == 0xd0) ? 1 : 2;
+    if (p + len > end || (e = push (l)) == NULL) {
+      return -1;
+      }
+    e->tick = tick;
+    e->size = len + 1;
+    e->data[0] = status;
+    memcpy (e->data + 1, p, len);
+    p += len;
+    }
+  return 0;
+}
+
+static int by_time (const void *a, const void *b)
+{
+  const rawevent *x = a, *y = b;
+
+  if (x->tick != y->tick) {
+    return x->tick < y->tick ? -1 : 1;
+    }
+  return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+smf_event *smf_load (const char *path, unsigned long rate, size_t *count)
+{
+  FILE *f;
+  long flen;
+  uint8_t *buf = NULL;
+  const uint8_t *p, *end;
+  uint32_t len, division, tempo = 500000;
+  rawlist l = { NULL, 0, 0 };
+  smf_event *out = NULL;
+  uint64_t last_tick = 0;
+  double sec = 0;
+  size_t i, n = 0;
+
+  if ((f = fopen (path, "rb")) == NULL) {
+    return NULL;
+    }
+  if (fseek (f, 0, SEEK_END) == 0 && (flen = ftell (f)) > 14 && (buf = malloc (flen)) != NULL) {
+    rewind (f);
+    if (fread (buf, 1, flen, f) != (size_t) flen) {
+      free (buf);
+      buf = NULL;
+      }
+    }
+  fclose (f);
+  if (buf == NULL) {
+    return NULL;
+    }
+
+  end = buf + flen;
+  if (memcmp (buf, "MThd", 4) || (len = be (buf + 4, 4)) < 6 || 8 + len > (uint32_t) flen) {
+    goto fail;
+    }
+  division = be (buf + 12, 2);
+  if ((division & 0x7fff) == 0 || ((division & 0x8000) && (division & 0xff) == 0)) {
+    goto fail;
+    }
+
+  for (p = buf + 8 + len; p + 8 <= end; p += 8 + len) {
+    len = be (p + 4, 4);
+    if (p + 8 + len > end) {
+      goto fail;
+      }
+    if (!memcmp (p, "MTrk", 4) && parse_track (&l, p + 8, p + 8 + len)) {
+      goto fail;
+      }
+    }
+
+  qsort (l.ev, l.count, sizeof (rawevent), by_time);
+
+  if ((out = malloc ((l.count + 1) * sizeof (smf_event))) == NULL) {
+    goto fail;
+    }
+
+  for (i=0; i<l.count; i++) {
+    const rawevent *e = &l.ev[i];
+
+    if (division & 0x8000) {
+      /* SMPTE: frames per second times ticks per frame */
+      sec = e->tick / ((double) -(int8_t) (division >> 8) * (division & 0xff));
+    } else {
+      sec += (e->tick - last_tick) * (tempo / 1e6) / division;
+      last_tick = e->tick;
+      }
+
+    if (e->tempo) {
+      tempo = e->tempo;
+      continue;
+      }
+    out[n].frame = llround (sec * rate);
+    out[n].size = e->size;
+    memcpy (out[n].data, e->data, 3);
+    n++;
+    }
+
+  free (l.ev);
+  free (buf);
+  *count = n;
+  return out;
+
+fail:
+  free (l.ev);
+  free (buf);
+  return NULL;
+}
@@ -0,0 +1,22 @@
+/*
+ * Standard MIDI File reader for offline rendering.  Every track is
+ * merged into one list of channel messages stamped with the frame they
+ * fall on at a given sample rate, following the file's tempo map.
+ */
+
+#ifndef SMF_H
+#define SMF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+  uint64_t frame;
+  uint8_t  size;
+  uint8_t  data[3];
+  } smf_event;
+
+/* returns a malloc'd array of *count events in time order, or NULL */
+smf_event *smf_load (const char *path, unsigned long rate, size_t *count);
+
+#endif
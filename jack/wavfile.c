@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wavfile.h"
+
+#define WAV_HEADER (44)
+#define DS64_SIZE (28)
+#define LARGE_HEADER (52 + DS64_SIZE)  /* RIFF, JUNK/ds64, fmt, data */
+
+static void put16 (uint8_t *p, uint16_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put32 (uint8_t *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static void put64 (uint8_t *p, uint64_t v)
+{
+  put32 (p, v);
+  put32 (p + 4, v >> 32);
+}
+
+static uint32_t get16 (const uint8_t *p)
+{
+  return p[0] | p[1] << 8;
+}
+
+static uint32_t get32 (const uint8_t *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint64_t get64 (const uint8_t *p)
+{
+  return get32 (p) | (uint64_t) get32 (p + 4) << 32;
+}
+
+static void fmt_chunk (uint8_t *h, const wavfile *w)
+{
+  memcpy (h, "fmt ", 4);
+  put32 (h + 4, 16);
+  put16 (h + 8, 3);  /* IEEE float */
+  put16 (h + 10, w->channels);
+  put32 (h + 12, w->rate);
+  put32 (h + 16, w->rate * w->channels * sizeof (float));
+  put16 (h + 20, w->channels * sizeof (float));
+  put16 (h + 22, 32);
+}
+
+static void wav_header (uint8_t *h, const wavfile *w)
+{
+  const uint32_t bytes = w->bytes;
+
+  memcpy (h, "RIFF", 4);
+  put32 (h + 4, WAV_HEADER - 8 + bytes);
+  memcpy (h + 8, "WAVE", 4);
+  fmt_chunk (h + 12, w);
+  memcpy (h + 36, "data", 4);
+  put32 (h + 40, bytes);
+}
+
+/* h holds w->header bytes; the JUNK chunk becomes ds64 past 4GB */
+static void large_header (uint8_t *h, const wavfile *w)
+{
+  const uint32_t junk = w->header - 52;
+  const uint64_t riff = w->header - 8 + w->bytes;
+  const int rf64 = riff > 0xffffffff;
+
+  memset (h, 0, w->header);
+  memcpy (h, rf64 ? "RF64" : "RIFF", 4);
+  put32 (h + 4, rf64 ? 0xffffffff : riff);
+  memcpy (h + 8, "WAVE", 4);
+  memcpy (h + 12, rf64 ? "ds64" : "JUNK", 4);
+  put32 (h + 16, junk);
+  if (rf64) {
+    put64 (h + 20, riff);
+    put64 (h + 28, w->bytes);
+    put64 (h + 36, w->bytes / (w->channels * sizeof (float)));
+    }
+  fmt_chunk (h + 20 + junk, w);
+  memcpy (h + w->header - 8, "data", 4);
+  put32 (h + w->header - 4, rf64 ? 0xffffffff : w->bytes);
+}
+
+int wav_create (wavfile *w, const char *path, int channels, unsigned long rate)
+{
+  uint8_t h[WAV_HEADER];
+
+  w->channels = channels;
+  w->rate = rate;
+  w->bytes = 0;
+  w->header = WAV_HEADER;
+  if ((w->f = fopen (path, "wb")) == NULL) {
+    return -1;
+    }
+  wav_header (h, w);
+  return fwrite (h, sizeof (h), 1, w->f) == 1 ? 0 : -1;
+}
+
+int wav_create_large (wavfile *w, const char *path, int channels, unsigned long rate, uint32_t align)
+{
+  uint8_t *h;
+  int r;
+
+  w->channels = channels;
+  w->rate = rate;
+  w->bytes = 0;
+  w->header = align > 1 ? (LARGE_HEADER + align - 1) / align * align : LARGE_HEADER;
+  if ((h = malloc (w->header)) == NULL) {
+    return -1;
+    }
+  if ((w->f = fopen (path, "wb")) == NULL) {
+    free (h);
+    return -1;
+    }
+  /* blocks go straight to write(2) rather than through stdio's buffer */
+  setvbuf (w->f, NULL, _IONBF, 0);
+  large_header (h, w);
+  r = fwrite (h, w->header, 1, w->f) == 1 ? 0 : -1;
+  free (h);
+  return r;
+}
+
+int wav_write (wavfile *w, const float *buf, size_t frames)
+{
+  /* samples are written as-is, so this assumes a little endian host */
+  if (fwrite (buf, sizeof (float) * w->channels, frames, w->f) != frames) {
+    return -1;
+    }
+  w->bytes += frames * w->channels * sizeof (float);
+  return 0;
+}
+
+int wav_write_raw (wavfile *w, const void *buf, size_t bytes)
+{
+  if (fwrite (buf, 1, bytes, w->f) != bytes) {
+    return -1;
+    }
+  w->bytes += bytes;
+  return 0;
+}
+
+int wav_close (wavfile *w)
+{
+  uint8_t *h = malloc (w->header);
+  int r = 0;
+
+  if (h == NULL) {
+    r = -1;
+    }
+  else {
+    if (w->header == WAV_HEADER) {
+      wav_header (h, w);
+    } else {
+      large_header (h, w);
+      }
+    if (fseek (w->f, 0, SEEK_SET) || fwrite (h, w->header, 1, w->f) != 1) {
+      r = -1;
+      }
+    free (h);
+    }
+  if (fclose (w->f)) {
+    r = -1;
+    }
+  w->f = NULL;
+  return r;
+}
+
+float *wav_read (const char *path, int *channels, unsigned long *rate, size_t *frames)
+{
+  uint8_t h[12], fmt[40], ds64[DS64_SIZE], *raw = NULL;
+  int format = 0, bits = 0, nch = 0, bps, have_data = 0;
+  uint64_t size, data64 = 0;
+  float *buf = NULL;
+  FILE *f;
+  size_t i, n;
+
+  if ((f = fopen (path, "rb")) == NULL) {
+    return NULL;
+    }
+  if (fread (h, 12, 1, f) != 1 || (memcmp (h, "RIFF", 4) && memcmp (h, "RF64", 4)) || memcmp (h + 8, "WAVE", 4)) {
+    goto out;
+    }
+
+  /* walk the chunks up to the data, picking up the format on the way */
+  while (fread (h, 8, 1, f) == 1) {
+    size = get32 (h + 4);
+    if (memcmp (h, "fmt ", 4) == 0 && size >= 16) {
+      if (fread (fmt, size < sizeof (fmt) ? size : sizeof (fmt), 1, f) != 1) {
+        goto out;
+        }
+      format = get16 (fmt);
+      nch = get16 (fmt + 2);
+      *rate = get32 (fmt + 4);
+      bits = get16 (fmt + 14);
+      if (format == 0xfffe && size >= 26) {
+        /* WAVE_FORMAT_EXTENSIBLE: the real format leads the subformat GUID */
+        format = get16 (fmt + 24);
+        }
+      if (fseek (f, (size > sizeof (fmt) ? size - sizeof (fmt) : 0) + (size & 1), SEEK_CUR)) {
+        goto out;
+        }
+      }
+    else if (memcmp (h, "ds64", 4) == 0 && size >= DS64_SIZE) {
+      if (fread (ds64, DS64_SIZE, 1, f) != 1) {
+        goto out;
+        }
+      data64 = get64 (ds64 + 8);
+      if (fseek (f, size - DS64_SIZE + (size & 1), SEEK_CUR)) {
+        goto out;
+        }
+      }
+    else if (memcmp (h, "data", 4) == 0) {
+      if (size == 0xffffffff && data64) {
+        size = data64;
+        }
+      have_data = 1;
+      break;
+      }
+    else if (fseek (f, size + (size & 1), SEEK_CUR)) {
+      goto out;
+      }
+    }
+  if (!have_data || nch < 1 || !((format == 1 && (bits == 16 || bits == 24 || bits == 32)) || (format == 3 && bits == 32))) {
+    goto out;
+    }
+
+  bps = bits / 8;
+  n = size / (bps * nch) * nch;
+  raw = malloc (n * bps);
+  buf = malloc (n * sizeof (float));
+  if (raw == NULL || buf == NULL) {
+    goto fail;
+    }
+  n = fread (raw, bps, n, f) / nch * nch;
+  for (i=0; i<n; i++) {
+    const uint8_t *p = raw + i * bps;
+    if (format == 3) {
+      const uint32_t u = get32 (p);
+      memcpy (&buf[i], &u, sizeof (float));
+      }
+    else if (bits == 16) {
+      buf[i] = (int16_t) get16 (p) / 32768.0f;
+      }
+    else if (bits == 24) {
+      buf[i] = ((int32_t) (p[0] << 8 | p[1] << 16 | (uint32_t) p[2] << 24) >> 8) / 8388608.0f;
+      }
+    else {
+      buf[i] = (int32_t) get32 (p) / 2147483648.0f;
+      }
+    }
+  *channels = nch;
+  *frames = n / nch;
+  goto out;
+
+fail:
+  free (buf);
+  buf = NULL;
+out:
+  free (raw);
+  fclose (f);
+  return buf;
+}
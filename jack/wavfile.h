@@ -0,0 +1,45 @@
+/*
+ * Minimal WAV file support shared by the jack tools: 32 bit float
+ * interleaved output, and input of the common PCM and float formats.
+ *
+ * Files made with wav_create_large() reserve room for an RF64 ds64
+ * chunk in a JUNK chunk that also pads the header out to an alignment,
+ * so raw sample writes of whole blocks land on block boundaries.  They
+ * are unbuffered, and become RF64 on close if they outgrew 4GB.
+ */
+
+#ifndef WAVFILE_H
+#define WAVFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef struct {
+  FILE *f;
+  int channels;
+  unsigned long rate;
+  uint64_t bytes;       /* of sample data */
+  uint32_t header;      /* offset of the sample data */
+  } wavfile;
+
+/* open path for writing and put down a header; returns 0 on success */
+int wav_create (wavfile *w, const char *path, int channels, unsigned long rate);
+
+/* the same for long recordings: header padded to a multiple of align
+   bytes, RF64 if needed */
+int wav_create_large (wavfile *w, const char *path, int channels, unsigned long rate, uint32_t align);
+
+/* append frames of interleaved samples */
+int wav_write (wavfile *w, const float *buf, size_t frames);
+
+/* append bytes of interleaved samples, which need not be whole frames */
+int wav_write_raw (wavfile *w, const void *buf, size_t bytes);
+
+/* fill in the chunk sizes and close */
+int wav_close (wavfile *w);
+
+/* read a whole 16/24/32 bit PCM or 32 bit float file; returns a malloc'd
+   buffer of *frames interleaved frames, or NULL */
+float *wav_read (const char *path, int *channels, unsigned long *rate, size_t *frames);
+
+#endif